@@ -1,2 +1,2 @@
-g++ -g main.cpp hackASM/hackASM.cpp -o hackAssembler -std=c++11 -static-libgcc -static-libstdc++
-gdb --args hackAssembler.exe C:\Users\Night_Blader\Desktop\nand2tetris\nand2tetris\projects\06\pong\Pong.asm
+g++ -g -DHACK_COUNT_ALLOCATIONS main.cpp hackASM/hackASM.cpp hackASM/hackSource.cpp hackASM/hackBatch.cpp hackASM/hackParallel.cpp hackASM/hackScan.cpp hackASM/hackStats.cpp hackASM/hackCache.cpp hackASM/hackServer.cpp hackASM/hackStream.cpp hackASM/hackIncremental.cpp hackASM/hackObject.cpp hackASM/hackOptimize.cpp hackASM/hackExecute.cpp hackASM/hackDisassemble.cpp hackASM/hackSourceMap.cpp -o hackAssembler -std=c++17 -pthread -static-libgcc -static-libstdc++
+gdb --args hackAssembler.exe C:\Users\Night_Blader\Desktop\nand2tetris\nand2tetris\projects\06\pong\Pong.asm
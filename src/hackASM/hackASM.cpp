@@ -1,791 +1,1875 @@
-/************************************************************************-
- *	hackASM.cpp, the implementation for hackASM.h.
- *  
- * 
- *	Started: December 15, 2017
- *  Finished: December 22, 2017
- *  Updates:
- *		- 
- *	©2018 C. A. Acred all rights reserved.
- ----------------------------------------------------------*
-*/
-#include "hackASM.h"
-#include <iostream>
-#include <fstream>
-#include <algorithm>
-#include <bitset>
-
-// Resolver Implementations: 
-/**
- * Resolves input to be without whitespace, comments and variables/labels.
- * Saves result in this->output.
- * 
- * @param input unresolved asm code as string pointer.
- */
-Resolver::Resolver(string* input)
-{
-	initializeVars(); // Add built-in variables.
-	
-    varCounter = 0;
-	lineCounter = 0;
-	
-	*input = resolveExcess(input); // Find and remove all white space, excess newlines, and comments.
-	
-	*input = resolveLabels(input); // Find, add, and remove labels from input.
-	
-	*input = resolveSymbols(input); // Find, add, and replace all symbols from input.
-	
-	output = *input;
-	
-	return;
-}
-
-/**
- * Returns true if *input is a number.
- *
- * @param input Pointer to the string that is being tested.
- * @return true if *input is a number.
- */
-bool Resolver::isNumber(string* input)
-{
-    return !(*input).empty() && std::find_if((*input).begin(), 
-        (*input).end(), [](char c) { return !std::isdigit(c); }) == (*input).end();
-}
-
-/**
- * Adds a variable to both varNames and varRegNums.
- * The number associated with the variable will be VAR_ASSIGN_ADD_START + varCounter. 
- * This number correlates to the register the code will point to.
- * 
- * @param name The name of the variable
- * @param isLabel If name is a label, should be true.
- * @return The value of the new variable's register number as a string.
- */
-string Resolver::addVar(string name, bool isLabel)
-{
-	string temp;
-	varNames.push_back(name);
-	if (!isLabel)
-	{
-		temp = to_string(this->VAR_ASSIGN_ADD_START + varCounter);
-		varRegNums.push_back(temp);
-		varCounter++;
-	}
-	else 
-	{
-		temp = to_string(lineCounter);
-		varRegNums.push_back(temp);
-	}
-	
-	return temp;
-}
-
-/**
- * Adds a variable to both varNames and varRegNumm.
- * The number value will be the value in register.
- * 
- * @param name The name of the variable
- * @param register The value of the register correlating to this variable.
- * @return The value of the new variable's register number as a string.
- */
-string Resolver::addVar(string name, int reg)
-{
-	string temp;
-	varNames.push_back(name);
-	temp = to_string(reg);
-	varRegNums.push_back(temp);
-	
-	return temp;
-}
-
-/**
- * Resolves the variable name. If it is a number, it simply returns the number as it is not a variable.
- *
- * @param name The name of the potential variable
- * @param isLabel true if the var is a label.
- * @return Returns as a string the int value associated with this variable, or the int value from the asm file if it is not a variable.
- */
-string Resolver::resolveVar(string name, bool isLabel)
-{
-	if(!isNumber(&name)) // If the name is not a number, but a symbol
-	{
-		string varRegVal = findVar(name);
-		if (varRegVal == "-1") // If the var does not exist, add it.
-		{
-			return addVar(name, isLabel);
-		}
-		else
-			return varRegVal;
-	}
-	else 
-	{
-		return name;
-	}
-}
-
-/**
- * Finds a variable in varNames and returns the corresponding value from varRegNums.
- * Returns "-1" if not found.
- *
- * @param name The string of the variable's name.
- * @return The register number of the variable as a string.
- */
-string Resolver::findVar(string name)
-{
-	for (int i = 0; i < varNames.size(); i++)
-	{
-		if (varNames.at(i) == name)
-			return varRegNums.at(i);
-	}
-	return "-1";
-}
-
-/**
- * Gets the string output.
- * 
- * @return string output
- */
-string Resolver::getOutput()
-{
-    return this->output;
-}
-
-/**
- * Initializes the built in symbols. 
- */
-void Resolver::initializeVars()
-{
-	string temp = "";
-	for(int i = 0; i < 16; i++)
-	{
-		temp = "R" + std::to_string(i);
-		addVar(temp, i);
-	}
-	addVar("SCREEN", 16384);
-	addVar("KBD", 24576);
-	addVar("SP", 0);
-	addVar("LCL", 1);
-	addVar("ARG", 2);
-	addVar("THIS", 3);
-	addVar("THAT", 4);
-	return;
-}
-
-/**
- * Finds, adds, and removes label declarations from input.
- *
- * @param input The pointer to the string you wish to resolve.
- * @return The resolved version of input.
- */
-string Resolver::resolveLabels(string* input)
-{
-	int i = 0;
-	char curChar = ' ';
-	vector<string> temp;
-	string output = "";
-	
-    while (curChar != '\0')// Iterate through input until it ends.
-    {
-		curChar = input->at(i);
-		if (curChar == '(') // Check for labels, add them.
-		{
-			temp = Assembler::getLine(input, i+1, ')');
-			resolveVar(temp.at(0), true);
-			i += atoi(temp.at(1).c_str()); // Adjust the i to properly skip the aforementioned line.
-			i += 2; // Skip the closing ')' and the '\n'.
-		}
-		else
-		{
-			if (curChar == '\n') // If we are at a new line, increase line counter.
-				lineCounter++;
-			output.append(1, curChar);
-			i++;
-		}
-	}
-	output.append(1, '\0');
-	return output;
-}
-
-/**
- * Removes whitespace and comments from input.
- *
- * @param input The pointer to the string you wish to resolve.
- * @return The resolved version of input.
- */
-string Resolver::resolveExcess(string* input)
-{
-	int i = 0;
-	char curChar = input->at(0);
-	vector<string> temp;
-	string output = "";
-	string curLine = this->EMPTY_STR;
-	
-	while (curChar != '\0')// Iterate through input until it ends.
-    {
-        if (curChar == '/' && input->at(i+1) == '/') // If this line is a comment, skip it.
-        {
-            temp = Assembler::getLine(input, i);
-            i += atoi(temp.at(1).c_str()); // Skip '\n' char
-			if (curLine != this->EMPTY_STR) // If this is a comment after a command:
-			{
-				output.append(curLine);  // Add curLine to output plus '\n'.
-				output.append(1, '\n');
-				curLine = this->EMPTY_STR;
-			}
-        }
-		else if (curChar == '\n') // If it's a new line char:
-		{
-			if (curLine != this->EMPTY_STR) // If we are not on a new line (If this is not just an extra new line).
-			{
-				output.append(curLine);  // Add curLine to output plus '\n'.
-				output.append(1, curChar);
-				curLine = this->EMPTY_STR;
-			}
-			i++;
-		}
-		else
-		{
-			if (curChar != ' ') // Skip white space.
-				curLine.append(1, curChar);
-			i++;
-		}
-        curChar = input->at(i);
-	}
-	output.append(1, '\0');
-	
-	return output;
-}
-
-/**
- * Removes symbols and replaces them with their proper numbers.
- *
- * @param input The pointer to the string you wish to resolve.
- * @return The resolved version of input.
- */
-string Resolver::resolveSymbols(string* input)
-{
-	string output = "";
-	char curChar = input->at(0);
-	string curLine = this->EMPTY_STR;
-    vector<string> temp;
-    int i = 0;
-	
-	while (curChar != '\0')// Iterate through input until it ends.
-	{
-		if (curChar == '@') // Check for symbols(only used in A commands), add them.
-		{
-			temp = Assembler::getLine(input, i+1);
-			curLine.append(1, '@');
-			curLine.append(resolveVar(temp.at(0), false));
-			i += atoi(temp.at(1).c_str()); // Adjust the i to properly skip the aforementioned line.
-		}
-		else if (curChar == '\n') // If it's a new line char:
-		{
-			if (curLine != this->EMPTY_STR) // If we have been loading an asm line:
-			{
-				output.append(curLine);  // Add curLine to output plus '\n' if it is not the end of the file.
-				output.append(1, curChar);
-				curLine = this->EMPTY_STR;
-				lineCounter++; // We have reached a new line in the resolved asm file.
-			}
-			i++;
-		}
-		else
-		{
-			curLine.append(1, curChar); // If it is none of the above, add to curLine.
-			i++;
-		}
-		curChar = input->at(i);
-	}
-	output.append(1, '\0');
-	
-	return output;
-}
-
-
-// Interpreter: 
-/**
- * Interpretation logic is done here.
- * Requires input to be resolved by Resolver.
- * 
- * @param input The pointer to the string you wish to interpret. It MUST have been resolved with Resolver.
- */
-Interpreter::Interpreter(string* input)
-{
-	// Initialize Code Tables:
-	initializeCode();
-	
-	
-    output = "";
-	char curChar = input->at(0);
-	string curLine;
-	string curCommand = "";
-    vector<string> temp;
-	string tempS;
-    int i = 0;
-	
-	// C command vars:
-	string des = "";
-	string JMP = "";
-	string comp = "";
-	
-	while (true)// Simply loop; There is a break once a null char is reached.
-	{
-		if (input->at(i) == '\0')
-			return;
-		temp = Assembler::getLine(input, i); // Get first command.
-		curLine = temp.at(0);
-		i += atoi(temp.at(1).c_str()); // Adjust the i to properly skip the aforementioned line.
-		
-		// Interpretation logic:
-		if (curLine.at(0) == '@')
-		{
-			// A command logic:
-			curCommand.append(1, '0'); // MostSignificatnBit is OP code 0, denoting A command.
-			curLine = curLine.substr(1, curLine.size());
-			tempS = std::bitset<15>(atoi(curLine.c_str())).to_string(); // Convert remaining line to binary, as it is an address number.
-			curCommand += tempS;
-		}
-		else
-		{
-			// C command logic:
-			curCommand.append("111");
-			if (curLine.find(';') != string::npos) // If there is a jump:
-			{
-				des = curLine.substr(0, curLine.find_first_of(';')); // Des is from start to ;.
-				JMP = curLine.substr(curLine.find_first_of(';')+1, curLine.size()); // JMP is from ; to end.
-			}
-			else 
-			{
-				JMP = "";
-				des = curLine;
-			}
-			if (curLine.find('=') != string::npos) // If there is a computation:
-			{
-				comp = des.substr(curLine.find('=')+1, curLine.size());
-				des = des.substr(0, curLine.find('='));
-			}
-			else
-			{
-				comp = des;
-				des = "";
-			}
-			curCommand += getCompCode(comp);
-			curCommand += getDesCode(des);
-			curCommand += getJMPCode(JMP);
-		}
-		output.append(curCommand);
-		if (input->at(i) != '\0')
-			output.append(1, '\n'); 
-		
-		curCommand = "";
-	}
-	
-	return;
-}
-
-/**
- * Gets the corresponding hack code for input, which should be an asm des command.
- *
- * @param input The pointer to the string of the des command.
- * @return The string for the corresponding hack code.
- */
- string Interpreter::getDesCode(string input)
- {
-	for (int i = 0; i < this->desCode.size(); i++) // For every entry in desCode:
-	{
-		if (desCode.at(i).at(0) == input) // If the first part of the entry matches the input:
-			return desCode.at(i).at(1); // Return the second part, which is the corresponding hack code.
-	}
-	return "DesERROR";
- }
- 
- /**
- * Gets the corresponding hack code for input, which should be an asm comp command.
- *
- * @param input The pointer to the string of the comp command.
- * @return The string for the corresponding hack code.
- */
- string Interpreter::getCompCode(string input)
- {
-	for (int i = 0; i < this->compCode.size(); i++) // For every entry in compCode:
-	{
-		if (compCode.at(i).at(0) == input) // If the first part of the entry matches the input:
-			return compCode.at(i).at(1); // Return the second part, which is the corresponding hack code.
-	}
-	return "CompERROR";
- }
- 
- /**
- * Gets the corresponding hack code for input, which should be an asm JMP command.
- *
- * @param input The pointer to the string of the JMP command.
- * @return The string for the corresponding hack code.
- */
- string Interpreter::getJMPCode(string input)
- {
-	for (int i = 0; i < this->JMPCode.size(); i++) // For every entry in JMPCode:
-	{
-		if (JMPCode.at(i).at(0) == input) // If the first part of the entry matches the input:
-			return JMPCode.at(i).at(1); // Return the second part, which is the corresponding hack code.
-	}
-	return "JMPERROR";
- }
-
-/**
- * Initializes the code vectors. 
- * Each entry is also a vector. At(0), the asm code. At(1), the corresponding hack code.
- *
- * @return void.
- */
- void Interpreter::initializeCode()
- {
-	 vector<string> temp;
-	// Initialize comp Code:
-	temp.push_back("0");
-	temp.push_back("0101010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("1");
-	temp.push_back("0111111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("-1");
-	temp.push_back("0111010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D");
-	temp.push_back("0001100");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("A");
-	temp.push_back("0110000");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("!D");
-	temp.push_back("0001101");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("!A");
-	temp.push_back("0110011");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("-D");
-	temp.push_back("0001111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("-A");
-	temp.push_back("0110011");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D+1");
-	temp.push_back("0011111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("A+1");
-	temp.push_back("0110111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D-1");
-	temp.push_back("0001110");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("A-1");
-	temp.push_back("0110010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D+A");
-	temp.push_back("0000010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D-A");
-	temp.push_back("0010011");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("A-D");
-	temp.push_back("0000111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D&A");
-	temp.push_back("0000000");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D|A");
-	temp.push_back("0010101");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("M");
-	temp.push_back("1110000");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("!M");
-	temp.push_back("1110001");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("-M");
-	temp.push_back("1110011");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("M+1");
-	temp.push_back("1110111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("M-1");
-	temp.push_back("1110010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D+M");
-	temp.push_back("1000010");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D-M");
-	temp.push_back("1010011");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("M-D");
-	temp.push_back("1000111");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D&M");
-	temp.push_back("1000000");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D|M");
-	temp.push_back("1010101");
-	compCode.push_back(temp);
-	temp.clear();
-	
-	// Initialize dest code:
-	temp.push_back("");
-	temp.push_back("000");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("M");
-	temp.push_back("001");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("D");
-	temp.push_back("010");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("MD");
-	temp.push_back("011");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("A");
-	temp.push_back("100");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("AM");
-	temp.push_back("101");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("AD");
-	temp.push_back("110");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("AMD");
-	temp.push_back("111");
-	desCode.push_back(temp);
-	temp.clear();
-	
-	// Initialize JMP code:
-	
-	temp.push_back("");
-	temp.push_back("000");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JGT");
-	temp.push_back("001");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JEQ");
-	temp.push_back("010");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JGE");
-	temp.push_back("011");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JLT");
-	temp.push_back("100");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JNE");
-	temp.push_back("101");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JLE");
-	temp.push_back("110");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	temp.push_back("JMP");
-	temp.push_back("111");
-	JMPCode.push_back(temp);
-	temp.clear();
-	
-	return;
- }
-
-
-/**
- * Gets the output of the interpretation.
- *
- * @return The interpreted output as a NULL terminated string.
- */
- string Interpreter::getOutput()
- {
-	 return output;
- }
-
-// Assembler:
-Assembler::Assembler(){}
-
-/**
- * Assembles the input at path. Once done, outputs the result to a .hack file in the same dir as the input path.
- */
- int Assembler::assemble(char* path)
- {
-	if (loadInput(path) == 1)
-	{
-		return 1;
-	}
-	// Logic:
-	Resolver* resolvedASM = new Resolver(&input); // Resolve white space, comments and symbols.
-	string output = resolvedASM->getOutput();
-	
-	Interpreter* interpreter = new Interpreter(&output);
-	output = interpreter->getOutput();
-	
-	//Output:
-	string outputPath = string(path); // Get input path.
-	outputPath = outputPath.substr(0, outputPath.find_last_of(".")) + ".hack"; // Change file extension to hack.
-	ofstream outputFile;
-	outputFile.open(outputPath, ios::out);
-	outputFile << output;
-	outputFile.close();
-	return 0;
- }
- 
-/**
- * Load file at input into this->input.
- *
- * @param input The path as a char*.
- */
- int Assembler::loadInput(char* path)
- {
-	ifstream asmFile;
-	asmFile.open(path, ios::in);
-	if (!asmFile.is_open()) // If path does not open properly.
-	{
-		cout << "Path invalid; Usage: hackAssembler (path to .asm file)\n";
-		return 1;
-	}
-	
-	string temp; // Get the contents of the asm file into asmSource.
-	this->input = "";
-	while (std::getline(asmFile, temp))
-	{
-		this->input.append(temp);
-		this->input.append("\n");
-	}
-	asmFile.close();
-	this->input.append(1, '\0'); // Add NULL terminator char.
-	return 0;
- }
- 
- /**
- * Takes input, starts at start, and returns a string with the value to offset the received string and \n char.
- * 
- * @param input the string* of which you want the line.
- * @param start
- * @return The line as output.at(0), the value needed to offset the received string + \n at output.at(1) as a string.
- */
-vector<string> Assembler::getLine(string* input, int start)
-{
-    char curChar = input->at(start);
-    vector<string> output = {"", ""};
-    int i = start;
-    while (curChar != '\n')
-    {
-		output.at(0).append(1, curChar);
-		i++;
-        curChar = input->at(i);
-    }
-	i++;
-    output.at(1) = std::to_string(i - start);
-    
-    return output;
-}
-
-/**
- * Takes input, starts at start, and returns a string with the value to offset the received string and endChar.
- * 
- * @param input the string* of which you want the line.
- * @param start the position of the char you wish to start with.
- * @param endChar the char which you wish to end with. The char is not included in output.at(0).
- * @return The line as output.at(0), the value needed to offset the received string and endChar at output.at(1) as a string.
- */
-vector<string> Assembler::getLine(string* input, int start, char endChar)
-{
-    char curChar = input->at(start);
-    vector<string> output = {"", ""};
-    int i = start;
-    while (curChar != endChar)
-    {
-		output.at(0).append(1, curChar);
-		i++;
-        curChar = input->at(i);
-    }
-	i++;
-    output.at(1) = std::to_string(i - start);
-    
-    return output;
-}
-
-
-
-
-
-
+/************************************************************************-
+ *	hackASM.cpp, the implementation for hackASM.h.
+ *  
+ * 
+ *	Started: December 15, 2017
+ *  Finished: December 22, 2017
+ *  Updates:
+ *		- 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+// SymbolTable Implementations:
+/**
+ * Creates an empty symbol table.
+ */
+SymbolTable::SymbolTable()
+{
+	slots.assign(64, 0);
+	lookupCount = 0;
+	probeCount = 0;
+}
+
+/**
+ * FNV-1a hash of a name.
+ *
+ * @param name The first char of the name.
+ * @param length The number of chars in name.
+ * @return The 32 bit hash.
+ */
+uint32_t SymbolTable::hash(const char* name, int length)
+{
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < length; i++)
+	{
+		h ^= (unsigned char)name[i];
+		h *= 16777619u;
+	}
+	return h;
+}
+
+/**
+ * Doubles the hash table and re-inserts every symbol.
+ */
+void SymbolTable::grow()
+{
+	slots.assign(slots.size() * 2, 0);
+	size_t mask = slots.size() - 1;
+	for (size_t id = 0; id < symbols.size(); id++)
+	{
+		size_t slot = symbols[id].hash & mask;
+		while (slots[slot] != 0)
+			slot = (slot + 1) & mask;
+		slots[slot] = (int)id + 1;
+	}
+	return;
+}
+
+/**
+ * Finds a symbol by name.
+ *
+ * @param name The first char of the name.
+ * @param length The number of chars in name.
+ * @return The id of the symbol, or NOT_FOUND.
+ */
+int SymbolTable::find(const char* name, int length) const
+{
+	lookupCount++;
+	return probe(name, length, &probeCount);
+}
+
+/**
+ * Finds a symbol by name, like find, but without counting the lookup.
+ * Safe to call from several threads at once, as long as nothing is being added.
+ *
+ * @param name The first char of the name.
+ * @param length The number of chars in name.
+ * @return The id of the symbol, or NOT_FOUND.
+ */
+int SymbolTable::lookup(const char* name, int length) const
+{
+	long long probes = 0;
+	return probe(name, length, &probes);
+}
+
+/**
+ * Walks the hash table from name's home slot until name or an empty slot is found.
+ *
+ * @param name The first char of the name.
+ * @param length The number of chars in name.
+ * @param probes Increased by the number of slots looked at.
+ * @return The id of the symbol, or NOT_FOUND.
+ */
+int SymbolTable::probe(const char* name, int length, long long* probes) const
+{
+	uint32_t h = hash(name, length);
+	size_t mask = slots.size() - 1;
+	size_t slot = h & mask;
+	while (true)
+	{
+		(*probes)++;
+		int id = slots[slot] - 1;
+		if (id < 0) // Reached an empty slot, the name is not in the table.
+			return NOT_FOUND;
+		const Symbol& symbol = symbols[id];
+		if (symbol.hash == h && symbol.nameLength == length && 
+			namePool.compare(symbol.nameStart, length, name, length) == 0)
+			return id;
+		slot = (slot + 1) & mask;
+	}
+}
+
+/**
+ * Adds a symbol. The name must not already be in the table.
+ *
+ * @param name The first char of the name.
+ * @param length The number of chars in name.
+ * @param value The register or ROM number of the symbol.
+ * @return The id of the new symbol.
+ */
+int SymbolTable::add(const char* name, int length, int value)
+{
+	if ((symbols.size() + 1) * 2 > slots.size()) // Keep the table at most half full.
+		grow();
+	
+	Symbol symbol;
+	symbol.hash = hash(name, length);
+	symbol.nameStart = (int)namePool.size();
+	symbol.nameLength = length;
+	symbol.value = value;
+	namePool.append(name, length);
+	symbols.push_back(symbol);
+	
+	size_t mask = slots.size() - 1;
+	size_t slot = symbol.hash & mask;
+	while (slots[slot] != 0)
+		slot = (slot + 1) & mask;
+	slots[slot] = (int)symbols.size();
+	return (int)symbols.size() - 1;
+}
+
+/**
+ * @param id The id of the symbol.
+ * @return The register or ROM number of the symbol.
+ */
+int SymbolTable::getValue(int id) const
+{
+	return symbols[id].value;
+}
+
+/**
+ * @param id The id of the symbol.
+ * @param value The new register or ROM number of the symbol.
+ */
+void SymbolTable::setValue(int id, int value)
+{
+	symbols[id].value = value;
+	return;
+}
+
+/**
+ * @param id The id of the symbol.
+ * @return The symbol's name, in the table's own pool. Valid until the next add.
+ */
+string_view SymbolTable::getName(int id) const
+{
+	return string_view(namePool.data() + symbols[id].nameStart, symbols[id].nameLength);
+}
+
+/**
+ * @return The number of symbols in the table.
+ */
+int SymbolTable::size() const
+{
+	return (int)symbols.size();
+}
+
+/**
+ * @return The number of calls to find.
+ */
+long long SymbolTable::getLookupCount() const
+{
+	return lookupCount;
+}
+
+/**
+ * @return The number of slots looked at by all calls to find. Divide by getLookupCount() for the average probe length.
+ */
+long long SymbolTable::getProbeCount() const
+{
+	return probeCount;
+}
+
+/**
+ * The built-in symbols of the HACK computer. 
+ * Built once on first use, and copied by every Resolver.
+ *
+ * @return The table holding only the built-in symbols.
+ */
+const SymbolTable& SymbolTable::predefined()
+{
+	struct Predefined
+	{
+		const char* name;
+		int value;
+	};
+	static const Predefined PREDEFINED_SYMBOLS[] = {
+		{"R0", 0}, {"R1", 1}, {"R2", 2}, {"R3", 3}, {"R4", 4}, {"R5", 5}, {"R6", 6}, {"R7", 7},
+		{"R8", 8}, {"R9", 9}, {"R10", 10}, {"R11", 11}, {"R12", 12}, {"R13", 13}, {"R14", 14}, {"R15", 15},
+		{"SCREEN", 16384}, {"KBD", 24576}, 
+		{"SP", 0}, {"LCL", 1}, {"ARG", 2}, {"THIS", 3}, {"THAT", 4}
+	};
+	static const SymbolTable table = []()
+	{
+		SymbolTable temp;
+		for (size_t i = 0; i < sizeof(PREDEFINED_SYMBOLS) / sizeof(PREDEFINED_SYMBOLS[0]); i++)
+		{
+			const char* name = PREDEFINED_SYMBOLS[i].name;
+			temp.add(name, (int)string(name).size(), PREDEFINED_SYMBOLS[i].value);
+		}
+		return temp;
+	}();
+	return table;
+}
+
+
+// Resolver Implementations: 
+/**
+ * Resolves input to be without whitespace, comments and variables/labels.
+ * Saves result in this->program.
+ * 
+ * @param source unresolved asm code. It is only read, never copied.
+ * @param size The number of chars in source.
+ */
+Resolver::Resolver(const char* source, size_t size)
+{
+	resolve(source, size);
+}
+
+/**
+ * Creates a Resolver that has not resolved anything yet; call resolve.
+ */
+Resolver::Resolver()
+{
+	commandCount = 0;
+	varCounter = 0;
+	lineCounter = 0;
+	labelCount = 0;
+	newLineCount = 0;
+}
+
+Resolver::~Resolver(){}
+
+/**
+ * Resolves source, replacing the result of any earlier call. Buffers from earlier calls are reused.
+ * 
+ * @param source unresolved asm code. It is only read, never copied.
+ * @param size The number of chars in source.
+ * @param stats If not NULL, the scan and resolve times are saved here.
+ */
+void Resolver::resolve(const char* source, size_t size, AssemblyStats* stats)
+{
+	initializeVars(); // Add built-in variables.
+	
+    varCounter = 0;
+	lineCounter = 0;
+	
+	double start = (stats != NULL) ? AssemblyStats::now() : 0;
+	tokenize(source, size); // Find all commands, and add all labels, in one pass.
+	commandCount = lineCounter;
+	double scanned = (stats != NULL) ? AssemblyStats::now() : 0;
+	
+	resolveSymbols(source); // Find, add, and replace all symbols.
+	
+	if (stats != NULL)
+	{
+		stats->scanSeconds = scanned - start;
+		stats->resolveSeconds = AssemblyStats::now() - scanned;
+	}
+	return;
+}
+
+/**
+ * Returns true if input is a number.
+ *
+ * @param input The first char of the string that is being tested.
+ * @param length The number of chars in input.
+ * @return true if input is a number.
+ */
+bool Resolver::isNumber(const char* input, int length)
+{
+	if (length == 0)
+		return false;
+	for (int i = 0; i < length; i++)
+	{
+		if (input[i] < '0' || input[i] > '9')
+			return false;
+	}
+	return true;
+}
+
+/**
+ * Returns true if c is whitespace that is not a new line.
+ *
+ * @param c The char being tested.
+ * @return true if c is a space, tab or carriage return.
+ */
+bool Resolver::isBlank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+/**
+ * Converts a string of digits to a 15 bit address; larger numbers wrap around, as the HACK A register is 15 bits.
+ *
+ * @param input The first digit.
+ * @param length The number of digits.
+ * @return The number modulo 32768.
+ */
+int Resolver::parseNumber(const char* input, int length)
+{
+	int value = 0;
+	for (int i = 0; i < length; i++)
+		value = (value * 10 + (input[i] - '0')) & 0x7FFF;
+	return value;
+}
+
+/**
+ * Gets text without its whitespace. Most commands have none, so text is returned as is;
+ * otherwise the chars that are not whitespace are copied to scratch.
+ *
+ * @param text The first char of the text.
+ * @param length The number of chars in text.
+ * @param scratch Holds the copy, if one is needed.
+ * @param compactLength Set to the number of chars in the result.
+ * @return Either text or scratch's data.
+ */
+const char* Resolver::compact(const char* text, int length, string* scratch, int* compactLength)
+{
+	*compactLength = length;
+	for (int i = 0; i < length; i++)
+	{
+		if (isBlank(text[i])) // Rare; copy the text without its whitespace.
+		{
+			scratch->assign(text, i);
+			for (; i < length; i++)
+			{
+				if (!isBlank(text[i]))
+					scratch->append(1, text[i]);
+			}
+			*compactLength = (int)scratch->size();
+			return scratch->data();
+		}
+	}
+	return text;
+}
+
+/**
+ * Adds a variable to the symbol table.
+ * The number associated with the variable will be VAR_ASSIGN_ADD_START + varCounter. 
+ * This number correlates to the register the code will point to.
+ * 
+ * @param name The first char of the variable's name.
+ * @param length The number of chars in name.
+ * @param isLabel If name is a label, should be true. The number will then be the current ROM address, lineCounter.
+ * @return The new variable's register number.
+ */
+int Resolver::addVar(const char* name, int length, bool isLabel)
+{
+	int value;
+	if (!isLabel)
+	{
+		value = this->VAR_ASSIGN_ADD_START + varCounter;
+		varCounter++;
+	}
+	else 
+		value = lineCounter;
+	
+	symbols.add(name, length, value);
+	return value;
+}
+
+/**
+ * Resolves the variable name. If it is a number, it simply returns the number as it is not a variable.
+ *
+ * @param name The first char of the potential variable's name.
+ * @param length The number of chars in name.
+ * @param isLabel true if the var is a label.
+ * @return The int value associated with this variable, or the int value from the asm file if it is not a variable.
+ */
+int Resolver::resolveVar(const char* name, int length, bool isLabel)
+{
+	if (!isNumber(name, length)) // If the name is not a number, but a symbol
+	{
+		int varRegVal = findVar(name, length);
+		if (varRegVal == SymbolTable::NOT_FOUND) // If the var does not exist, add it.
+			return addVar(name, length, isLabel);
+		else
+			return varRegVal;
+	}
+	else 
+		return parseNumber(name, length);
+}
+
+/**
+ * Finds a variable in the symbol table.
+ *
+ * @param name The first char of the variable's name.
+ * @param length The number of chars in name.
+ * @return The register number of the variable, or SymbolTable::NOT_FOUND.
+ */
+int Resolver::findVar(const char* name, int length)
+{
+	int id = symbols.find(name, length);
+	if (id == SymbolTable::NOT_FOUND)
+		return SymbolTable::NOT_FOUND;
+	return symbols.getValue(id);
+}
+
+/**
+ * Gets the symbol table, holding the built-in symbols, labels and variables.
+ * 
+ * @return The symbol table.
+ */
+const SymbolTable& Resolver::getSymbols()
+{
+	return this->symbols;
+}
+
+/**
+ * Gets the commands found by tokenize, in ROM order.
+ * 
+ * @return The commands.
+ */
+const vector<Instruction>& Resolver::getInstructions()
+{
+	return this->instructions;
+}
+
+/**
+ * @return The number of variables added by addVar, not counting labels.
+ */
+int Resolver::getVarCount()
+{
+	return varCounter;
+}
+
+/**
+ * @return The number of labels added by tokenize.
+ */
+int Resolver::getLabelCount()
+{
+	return labelCount;
+}
+
+/**
+ * @return The number of new line chars in the source.
+ */
+int Resolver::getNewLineCount()
+{
+	return newLineCount;
+}
+
+/**
+ * Gets the resolved commands, for Interpreter and any other pass.
+ * 
+ * @return The commands, in ROM order.
+ */
+const Program& Resolver::getProgram()
+{
+    return this->program;
+}
+
+/**
+ * Initializes the built in symbols. 
+ */
+void Resolver::initializeVars()
+{
+	symbols = SymbolTable::predefined();
+	return;
+}
+
+/**
+ * Scans source once, finding every command and adding every label declaration 
+ * with the ROM address of the command that follows it.
+ * The commands are saved in this->instructions.
+ *
+ * @param source The unresolved asm code.
+ * @param size The number of chars in source.
+ */
+void Resolver::tokenize(const char* source, size_t size)
+{
+	vector<Label> labels;
+	string scratch;
+	int length;
+	
+	instructions.clear();
+	instructions.reserve(size / 8); // Rough guess of one command per 8 chars, avoids most regrowth.
+	newLineCount = scan(source, 0, size, &instructions, &labels);
+	int symbolCount = symbols.size();
+	
+	for (size_t i = 0; i < labels.size(); i++) // Labels are added in the order they are declared; the first declaration wins.
+	{
+		const char* name = compact(source + labels[i].start, labels[i].length, &scratch, &length);
+		lineCounter = labels[i].address;
+		resolveVar(name, length, true);
+	}
+	lineCounter = (int)instructions.size(); // ROM address after the last command.
+	labelCount = symbols.size() - symbolCount;
+	return;
+}
+
+/**
+ * Scans source from begin to end, skipping whitespace, empty lines, and comments.
+ * Does not resolve anything, so separate ranges of one source can be scanned at once.
+ * begin must be the start of a line.
+ *
+ * @param source The unresolved asm code.
+ * @param begin Offset of the first char to scan.
+ * @param end Offset one past the last char to scan.
+ * @param commands Every command found is added to the back, with its line number counted from begin.
+ * @param labels Every label declaration found is added to the back, with the number of commands before it.
+ * @return The number of new line chars scanned.
+ */
+int Resolver::scan(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels)
+{
+	return Scanner::scan(source, begin, end, commands, labels);
+}
+
+/**
+ * Builds the resolved commands from this->instructions, replacing symbols with their proper numbers
+ * and splitting C commands into their comp, dest and jump bits.
+ * Saves the result in this->program.
+ *
+ * @param source The asm code the instructions were found in.
+ */
+void Resolver::resolveSymbols(const char* source)
+{
+	string name = EMPTY_STR;
+	int comp, dest, jump;
+	
+	program.clear();
+	program.reserve(instructions.size());
+	for (size_t n = 0; n < instructions.size(); n++)
+	{
+		const Instruction& command = instructions[n];
+		const char* text = source + command.start;
+		int length;
+		if (command.kind == Instruction::A_COMMAND) // Symbols are only used in A commands.
+		{
+			const char* symbol = compact(text + 1, command.length - 1, &name, &length);
+			if (isNumber(symbol, length))
+				program.addA(parseNumber(symbol, length), SymbolTable::NOT_FOUND, command.line);
+			else
+			{
+				int id = symbols.find(symbol, length);
+				if (id == SymbolTable::NOT_FOUND) // If the var does not exist, add it.
+				{
+					addVar(symbol, length, false);
+					id = symbols.size() - 1;
+				}
+				program.addA(symbols.getValue(id) & 0x7FFF, id, command.line);
+			}
+		}
+		else
+		{
+			const char* code = compact(text, command.length, &name, &length);
+			if (Interpreter::splitC(code, length, &comp, &dest, &jump) == Interpreter::CODE_ERROR)
+				program.addInvalid(code, length, command.line);
+			else
+				program.addC(comp, dest, jump, command.line);
+		}
+	}
+	
+	return;
+}
+
+
+// Program:
+/**
+ * Empties every column, keeping their buffers.
+ */
+void Program::clear()
+{
+	kinds.clear();
+	comps.clear();
+	dests.clear();
+	jumps.clear();
+	values.clear();
+	symbols.clear();
+	lines.clear();
+	invalid.clear();
+	return;
+}
+
+/**
+ * @param count The number of commands to make room for in every column.
+ */
+void Program::reserve(size_t count)
+{
+	kinds.reserve(count);
+	comps.reserve(count);
+	dests.reserve(count);
+	jumps.reserve(count);
+	values.reserve(count);
+	symbols.reserve(count);
+	lines.reserve(count);
+	return;
+}
+
+/**
+ * @return The number of commands.
+ */
+size_t Program::size() const
+{
+	return kinds.size();
+}
+
+/**
+ * Adds an A command.
+ *
+ * @param value The number it loads.
+ * @param symbol The id of the symbol it names, or SymbolTable::NOT_FOUND.
+ * @param line Its line in the source.
+ */
+void Program::addA(int value, int symbol, int line)
+{
+	kinds.push_back(Instruction::A_COMMAND);
+	comps.push_back(0);
+	dests.push_back(0);
+	jumps.push_back(0);
+	values.push_back(value);
+	symbols.push_back(symbol);
+	lines.push_back(line);
+	return;
+}
+
+/**
+ * Adds a C command, as Interpreter::splitC gives its fields.
+ */
+void Program::addC(int comp, int dest, int jump, int line)
+{
+	kinds.push_back(Instruction::C_COMMAND);
+	comps.push_back((uint8_t)comp);
+	dests.push_back((uint8_t)dest);
+	jumps.push_back((uint8_t)jump);
+	values.push_back(0);
+	symbols.push_back((int)SymbolTable::NOT_FOUND);
+	lines.push_back(line);
+	return;
+}
+
+/**
+ * Adds a command that is not valid, keeping its text for the error message.
+ *
+ * @param text The command, without whitespace.
+ * @param length The number of chars in text.
+ * @param line Its line in the source.
+ */
+void Program::addInvalid(const char* text, int length, int line)
+{
+	kinds.push_back((uint8_t)INVALID);
+	comps.push_back(0);
+	dests.push_back(0);
+	jumps.push_back(0);
+	values.push_back((int)invalid.size());
+	symbols.push_back((int)SymbolTable::NOT_FOUND);
+	lines.push_back(line);
+	invalid.push_back(string(text, length));
+	return;
+}
+
+
+// Interpreter: 
+/**
+ * Interpretation logic is done here.
+ * Requires input to be resolved by Resolver.
+ * 
+ * @param input The commands you wish to interpret. They MUST have been resolved with Resolver.
+ */
+Interpreter::Interpreter(const Program* input)
+{
+	interpret(input);
+}
+
+/**
+ * Creates an Interpreter that has not interpreted anything yet; call interpret.
+ */
+Interpreter::Interpreter()
+{
+	error = "";
+	errorCommand = -1;
+}
+
+Interpreter::~Interpreter(){}
+
+/**
+ * Interprets input, replacing the result of any earlier call. Buffers from earlier calls are reused.
+ * The fields are already split, so this is one pass over the columns in ROM order.
+ * 
+ * @param input The commands you wish to interpret. They MUST have been resolved with Resolver.
+ * @return 0 on success, 1 if a command is invalid; see getError().
+ */
+int Interpreter::interpret(const Program* input)
+{
+	size_t count = input->size();
+	const uint8_t* kinds = input->kinds.data();
+	const uint8_t* comps = input->comps.data();
+	const uint8_t* dests = input->dests.data();
+	const uint8_t* jumps = input->jumps.data();
+	const int* values = input->values.data();
+	error = "";
+	errorCommand = -1;
+	words.resize(count);
+	uint16_t* out = words.data();
+	
+	for (size_t n = 0; n < count; n++)
+	{
+		if (kinds[n] == Instruction::A_COMMAND)
+			out[n] = (uint16_t)values[n]; // A command logic: MostSignificatnBit is OP code 0, the rest is the 15 bit address.
+		else if (kinds[n] == Instruction::C_COMMAND)
+			out[n] = (uint16_t)(0xE000 | comps[n] << 6 | dests[n] << 3 | jumps[n]); // The 3 MostSignificantBits are 111.
+		else
+		{
+			error = "Invalid command: " + input->invalid[values[n]];
+			errorCommand = (int)n;
+			words.resize(n);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Packs up to 3 chars into an int, so a field can be matched with a switch.
+ *
+ * @param input The first char of the field.
+ * @param length The number of chars in the field.
+ * @return The packed field, or 0xFFFFFFFF if it is too long to be valid.
+ */
+uint32_t Interpreter::pack(const char* input, int length)
+{
+	switch (length)
+	{
+		case 0: return 0;
+		case 1: return pack(input[0]);
+		case 2: return pack(input[0], input[1]);
+		case 3: return pack(input[0], input[1], input[2]);
+		default: return 0xFFFFFFFF;
+	}
+}
+
+/**
+ * Gets the corresponding hack code for input, which should be an asm des command.
+ *
+ * @param input The first char of the des command.
+ * @param length The number of chars in the des command.
+ * @return The 3 dest bits, or CODE_ERROR.
+ */
+int Interpreter::getDesCode(const char* input, int length)
+{
+	switch (pack(input, length))
+	{
+		case pack(0):             return 0;
+		case pack('M'):           return 1;
+		case pack('D'):           return 2;
+		case pack('M', 'D'):      return 3;
+		case pack('A'):           return 4;
+		case pack('A', 'M'):      return 5;
+		case pack('A', 'D'):      return 6;
+		case pack('A', 'M', 'D'): return 7;
+		default:                  return CODE_ERROR;
+	}
+}
+
+/**
+ * Gets the corresponding hack code for input, which should be an asm comp command.
+ *
+ * @param input The first char of the comp command.
+ * @param length The number of chars in the comp command.
+ * @return The 7 comp bits (a bit first), or CODE_ERROR.
+ */
+int Interpreter::getCompCode(const char* input, int length)
+{
+	switch (pack(input, length))
+	{
+		case pack('0'):           return 0x2A; // 0101010
+		case pack('1'):           return 0x3F; // 0111111
+		case pack('-', '1'):      return 0x3A; // 0111010
+		case pack('D'):           return 0x0C; // 0001100
+		case pack('A'):           return 0x30; // 0110000
+		case pack('!', 'D'):      return 0x0D; // 0001101
+		case pack('!', 'A'):      return 0x31; // 0110001
+		case pack('-', 'D'):      return 0x0F; // 0001111
+		case pack('-', 'A'):      return 0x33; // 0110011
+		case pack('D', '+', '1'): return 0x1F; // 0011111
+		case pack('A', '+', '1'): return 0x37; // 0110111
+		case pack('D', '-', '1'): return 0x0E; // 0001110
+		case pack('A', '-', '1'): return 0x32; // 0110010
+		case pack('D', '+', 'A'): return 0x02; // 0000010
+		case pack('D', '-', 'A'): return 0x13; // 0010011
+		case pack('A', '-', 'D'): return 0x07; // 0000111
+		case pack('D', '&', 'A'): return 0x00; // 0000000
+		case pack('D', '|', 'A'): return 0x15; // 0010101
+		case pack('M'):           return 0x70; // 1110000
+		case pack('!', 'M'):      return 0x71; // 1110001
+		case pack('-', 'M'):      return 0x73; // 1110011
+		case pack('M', '+', '1'): return 0x77; // 1110111
+		case pack('M', '-', '1'): return 0x72; // 1110010
+		case pack('D', '+', 'M'): return 0x42; // 1000010
+		case pack('D', '-', 'M'): return 0x53; // 1010011
+		case pack('M', '-', 'D'): return 0x47; // 1000111
+		case pack('D', '&', 'M'): return 0x40; // 1000000
+		case pack('D', '|', 'M'): return 0x55; // 1010101
+		default:                  return CODE_ERROR;
+	}
+}
+
+/**
+ * Gets the corresponding hack code for input, which should be an asm JMP command.
+ *
+ * @param input The first char of the JMP command.
+ * @param length The number of chars in the JMP command.
+ * @return The 3 jump bits, or CODE_ERROR.
+ */
+int Interpreter::getJMPCode(const char* input, int length)
+{
+	switch (pack(input, length))
+	{
+		case pack(0):             return 0;
+		case pack('J', 'G', 'T'): return 1;
+		case pack('J', 'E', 'Q'): return 2;
+		case pack('J', 'G', 'E'): return 3;
+		case pack('J', 'L', 'T'): return 4;
+		case pack('J', 'N', 'E'): return 5;
+		case pack('J', 'L', 'E'): return 6;
+		case pack('J', 'M', 'P'): return 7;
+		default:                  return CODE_ERROR;
+	}
+}
+
+/**
+ * Splits a whole C command, dest=comp;JMP, where dest and JMP are optional, into its bits.
+ *
+ * @param input The first char of the C command, without whitespace.
+ * @param length The number of chars in the C command.
+ * @param comp Set to the 7 comp bits.
+ * @param dest Set to the 3 dest bits.
+ * @param jump Set to the 3 jump bits.
+ * @return 0, or CODE_ERROR if any field is not valid.
+ */
+int Interpreter::splitC(const char* input, int length, int* comp, int* dest, int* jump)
+{
+	int equals = -1; // Position of '=', if there is a dest.
+	int semicolon = length; // Position of ';', or the end if there is no jump.
+	for (int i = 0; i < length; i++)
+	{
+		if (input[i] == '=' && equals < 0 && semicolon == length)
+			equals = i;
+		else if (input[i] == ';' && semicolon == length)
+			semicolon = i;
+	}
+	
+	*dest = getDesCode(input, equals < 0 ? 0 : equals);
+	*comp = getCompCode(input + equals + 1, semicolon - equals - 1);
+	*jump = (semicolon == length) ? 0 : getJMPCode(input + semicolon + 1, length - semicolon - 1);
+	if (*dest == CODE_ERROR || *comp == CODE_ERROR || *jump == CODE_ERROR)
+		return CODE_ERROR;
+	return 0;
+}
+
+/**
+ * Encodes a whole C command, dest=comp;JMP, where dest and JMP are optional.
+ *
+ * @param input The first char of the C command, without whitespace.
+ * @param length The number of chars in the C command.
+ * @return The 16 bit hack code, or CODE_ERROR.
+ */
+int Interpreter::encodeC(const char* input, int length)
+{
+	int des, comp, JMP;
+	if (splitC(input, length, &comp, &des, &JMP) == CODE_ERROR)
+		return CODE_ERROR;
+	return 0xE000 | comp << 6 | des << 3 | JMP; // The 3 MostSignificantBits are 111.
+}
+
+/**
+ * Gets the output of the interpretation.
+ *
+ * @return The hack code, one word per command in ROM order.
+ */
+ const vector<uint16_t>& Interpreter::getWords()
+ {
+	 return words;
+ }
+
+/**
+ * Gets the reason interpretation stopped.
+ *
+ * @return The error message, or an empty string if every command was valid.
+ */
+ string Interpreter::getError()
+ {
+	 return error;
+ }
+
+/**
+ * Gets the number of the command that stopped interpretation, counted from 0 in ROM order.
+ *
+ * @return The command number, or -1 if every command was valid.
+ */
+ int Interpreter::getErrorCommand()
+ {
+	 return errorCommand;
+ }
+
+// Formatter:
+/**
+ * The 8 '0'/'1' chars of every byte value, MostSignificantBit first. Built once on first use.
+ *
+ * @return The table, indexed by byte value.
+ */
+const char (*Formatter::bitChars())[8]
+{
+	struct Table
+	{
+		char chars[256][8];
+		Table()
+		{
+			for (int value = 0; value < 256; value++)
+			{
+				for (int bit = 0; bit < 8; bit++)
+					chars[value][bit] = (char)('0' + ((value >> (7 - bit)) & 1));
+			}
+		}
+	};
+	static const Table table;
+	return table.chars;
+}
+
+/**
+ * @param wordCount The number of words.
+ * @return The exact size of their .hack text: 17 chars per word, without a new line after the last.
+ */
+size_t Formatter::hackSize(size_t wordCount)
+{
+	return (wordCount == 0) ? 0 : wordCount * 17 - 1;
+}
+
+/**
+ * Formats words as .hack text: each word as 16 '0'/'1' chars, MostSignificantBit first, 
+ * one per line, with no new line after the last word.
+ * Each word takes two 8 byte copies from the bitChars table.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @param out Where the text is written; must hold hackSize(count) chars.
+ */
+void Formatter::writeHack(const uint16_t* words, size_t count, char* out)
+{
+	const char (*table)[8] = bitChars();
+	for (size_t i = 0; i < count; i++)
+	{
+		uint16_t word = words[i];
+		memcpy(out, table[word >> 8], 8);
+		memcpy(out + 8, table[word & 0xFF], 8);
+		if (i + 1 < count)
+			out[16] = '\n';
+		out += 17;
+	}
+	return;
+}
+
+/**
+ * Formats words as .hack text; see writeHack.
+ *
+ * @param words The hack code.
+ * @return The .hack file contents.
+ */
+string Formatter::toHack(const vector<uint16_t>& words)
+{
+	string output(hackSize(words.size()), '\0');
+	if (!words.empty())
+		writeHack(words.data(), words.size(), &output[0]);
+	return output;
+}
+
+/**
+ * Gets the size of a ROM image.
+ *
+ * @param wordCount The number of words.
+ * @return The number of bytes writeROM writes.
+ */
+size_t Formatter::romSize(size_t wordCount)
+{
+	return ROM_HEADER_SIZE + wordCount * 2;
+}
+
+/**
+ * Writes words as a ROM image; see the class comment for the layout.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @param out Where the image is written; must hold romSize(count) bytes.
+ */
+void Formatter::writeROM(const uint16_t* words, size_t count, char* out)
+{
+	writeROMHeader(words, count, out);
+	unsigned char* bytes = (unsigned char*)out + ROM_HEADER_SIZE;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	for (size_t i = 0; i < count; i++)
+	{
+		bytes[2 * i] = (unsigned char)words[i];
+		bytes[2 * i + 1] = (unsigned char)(words[i] >> 8);
+	}
+#else
+	if (count > 0)
+		memcpy(bytes, words, count * 2); // Already little-endian.
+#endif
+	return;
+}
+
+/**
+ * Writes only the header of a ROM image, so the words can be written after it a block at a time.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @param out Where the header is written; must hold ROM_HEADER_SIZE bytes.
+ */
+void Formatter::writeROMHeader(const uint16_t* words, size_t count, char* out)
+{
+	uint32_t sum = checksum(words, count);
+	const uint32_t header[] = {
+		0x4D4F5248,                            // "HROM"
+		1 | (uint32_t)ROM_HEADER_SIZE << 16, // Version and header size.
+		(uint32_t)count,
+		sum};
+	unsigned char* bytes = (unsigned char*)out;
+	for (int i = 0; i < 4; i++)
+	{
+		for (int b = 0; b < 4; b++)
+			bytes[i * 4 + b] = (unsigned char)(header[i] >> (8 * b));
+	}
+	return;
+}
+
+/**
+ * Formats words as a ROM image; see writeROM.
+ *
+ * @param words The hack code.
+ * @return The image.
+ */
+string Formatter::toROM(const vector<uint16_t>& words)
+{
+	string output(romSize(words.size()), '\0');
+	writeROM(words.data(), words.size(), &output[0]);
+	return output;
+}
+
+/**
+ * Checks a ROM image and reads its words. A simulator on a little-endian machine
+ * can instead map the image and use the words at ROM_HEADER_SIZE in place, once checked.
+ *
+ * @param data The image.
+ * @param size The number of bytes in data.
+ * @param words Set to the words.
+ * @return 0 on success, 1 if data is not a valid ROM image.
+ */
+int Formatter::readROM(const char* data, size_t size, vector<uint16_t>* words)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	if (size < ROM_HEADER_SIZE || memcmp(data, "HROM", 4) != 0)
+		return 1;
+	uint32_t header[4];
+	for (int i = 0; i < 4; i++)
+		header[i] = bytes[i * 4] | bytes[i * 4 + 1] << 8 | bytes[i * 4 + 2] << 16 | (uint32_t)bytes[i * 4 + 3] << 24;
+	size_t headerSize = header[1] >> 16;
+	size_t count = header[2];
+	if ((header[1] & 0xFFFF) != 1 || headerSize < ROM_HEADER_SIZE || size < headerSize || (size - headerSize) / 2 < count)
+		return 1;
+	
+	words->resize(count);
+	bytes += headerSize;
+	for (size_t i = 0; i < count; i++)
+		(*words)[i] = (uint16_t)(bytes[2 * i] | bytes[2 * i + 1] << 8);
+	if (checksum(words->data(), count) != header[3])
+	{
+		words->clear();
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Reads .hack text back into words, the inverse of writeHack.
+ * Lines may end in "\r\n", and the last may end in a new line or not.
+ *
+ * @param data The text.
+ * @param size The number of chars in data.
+ * @param words Set to the words.
+ * @return 0 on success, 1 if a line is not 16 '0'/'1' chars.
+ */
+int Formatter::readHack(const char* data, size_t size, vector<uint16_t>* words)
+{
+	words->resize(size / 16 + 1); // The most lines there can be; cut down at the end.
+	uint16_t* out = words->data();
+	size_t count = 0;
+	size_t i = 0;
+	while (i < size)
+	{
+		if (size - i < 16)
+		{
+			words->clear();
+			return 1;
+		}
+		unsigned word = 0;
+		unsigned bad = 0;
+		for (int b = 0; b < 16; b++)
+		{
+			unsigned bit = (unsigned char)data[i + b] - '0';
+			bad |= bit;
+			word = word << 1 | bit;
+		}
+		i += 16;
+		if (i < size && data[i] == '\r')
+			i++;
+		if (bad > 1 || (i < size && data[i++] != '\n'))
+		{
+			words->clear();
+			return 1;
+		}
+		out[count++] = (uint16_t)word;
+	}
+	words->resize(count);
+	return 0;
+}
+
+/**
+ * Fletcher-32 of words, which catches any single changed word and most swapped ones.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @return The checksum.
+ */
+uint32_t Formatter::checksum(const uint16_t* words, size_t count)
+{
+	uint32_t sum1 = 0xFFFF;
+	uint32_t sum2 = 0xFFFF;
+	while (count > 0)
+	{
+		size_t block = (count < 359) ? count : 359; // The most words before the sums can overflow.
+		count -= block;
+		for (size_t i = 0; i < block; i++)
+		{
+			sum1 += words[i];
+			sum2 += sum1;
+		}
+		words += block;
+		sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+		sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	}
+	sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+	sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	return sum2 << 16 | sum1;
+}
+
+/**
+ * @param words The hack code.
+ * @param format FORMAT_HACK or FORMAT_ROM.
+ * @return The file contents in format.
+ */
+string Formatter::format(const vector<uint16_t>& words, int format)
+{
+	return (format == FORMAT_ROM) ? toROM(words) : toHack(words);
+}
+
+/**
+ * @param format FORMAT_HACK, FORMAT_ROM or FORMAT_OBJECT.
+ * @return The file extension for format, without the dot.
+ */
+string Formatter::extension(int format)
+{
+	if (format == FORMAT_OBJECT)
+		return "hobj";
+	return (format == FORMAT_ROM) ? "rom" : "hack";
+}
+
+/**
+ * Writes data to the file at path with one write, replacing the file.
+ *
+ * @param path The path of the file, or "-" for stdout.
+ * @param data The bytes to write.
+ * @param size The number of bytes.
+ * @return 0 on success, 1 if the file could not be written.
+ */
+int Formatter::writeFile(const string& path, const char* data, size_t size)
+{
+	FILE* file = (path == "-") ? stdout : fopen(path.c_str(), "wb");
+	if (file == NULL)
+		return 1;
+	bool failed = (size > 0 && fwrite(data, 1, size, file) != size);
+	if (file == stdout)
+		failed |= (fflush(file) != 0);
+	else
+		failed |= (fclose(file) != 0);
+	return failed ? 1 : 0;
+}
+
+// AssemblyContext:
+AssemblyContext::AssemblyContext()
+{
+	threads = 1;
+	statsOn = false;
+	sourceMapOn = false;
+}
+
+/**
+ * Turns the stats in AssemblyResult on or off. They are off by default, and cost nothing then.
+ *
+ * @param on true to fill in AssemblyResult::stats.
+ */
+void AssemblyContext::setStats(bool on)
+{
+	statsOn = on;
+	return;
+}
+
+/**
+ * Turns AssemblyResult::sourceMap on or off. It is off by default. The map is built from the resolved program,
+ * so a source is assembled on one thread while it is on.
+ *
+ * @param on true to build the source map.
+ */
+void AssemblyContext::setSourceMap(bool on)
+{
+	sourceMapOn = on;
+	return;
+}
+
+/**
+ * Sets the number of threads a single large source is assembled on. The default is 1.
+ *
+ * @param threads The number of threads.
+ */
+void AssemblyContext::setThreads(int threads)
+{
+	this->threads = threads;
+	return;
+}
+
+/**
+ * Assembles source.
+ *
+ * @param source The asm code.
+ * @return The hack code, symbols and diagnostics.
+ */
+AssemblyResult AssemblyContext::assemble(string_view source)
+{
+	AssemblyResult result;
+	assemble(source, &result);
+	return result;
+}
+
+/**
+ * Assembles source into result, reusing result's buffers.
+ *
+ * @param source The asm code.
+ * @param result Set to the hack code, symbols and diagnostics.
+ * @return result->ok.
+ */
+bool AssemblyContext::assemble(string_view source, AssemblyResult* result)
+{
+	result->words.clear();
+	result->diagnostics.clear();
+	AssemblyStats* stats = NULL;
+	if (statsOn)
+	{
+		result->stats = AssemblyStats();
+		stats = &result->stats;
+		stats->bytes = source.size();
+		AllocationCounter::start();
+	}
+	
+	result->sourceMap = SourceMap();
+	if (threads > 1 && !sourceMapOn && source.size() >= 2 * ParallelAssembler::MIN_CHUNK_SIZE) // Large enough to split.
+	{
+		ParallelAssembler parallel(threads);
+		result->ok = (parallel.assemble(source.data(), source.size(), &result->words, stats) == 0);
+		result->symbols = parallel.getSymbols();
+		if (!result->ok)
+			result->diagnostics.push_back(Diagnostic{parallel.getErrorLine(), parallel.getError()});
+	}
+	else
+	{
+		resolver.resolve(source.data(), source.size(), stats); // Resolve white space, comments and symbols.
+		result->symbols = resolver.getSymbols();
+		double start = (stats != NULL) ? AssemblyStats::now() : 0;
+		result->ok = (interpreter.interpret(&resolver.getProgram()) == 0);
+		if (stats != NULL)
+		{
+			stats->encodeSeconds = AssemblyStats::now() - start;
+			stats->lines = resolver.getNewLineCount() + 1;
+			stats->labels = resolver.getLabelCount();
+			stats->variables = resolver.getVarCount();
+		}
+		if (!result->ok)
+		{
+			int line = resolver.getProgram().lines[interpreter.getErrorCommand()];
+			result->diagnostics.push_back(Diagnostic{line, interpreter.getError()});
+		}
+		else
+		{
+			result->words = interpreter.getWords();
+			if (sourceMapOn)
+				result->sourceMap.build(resolver.getProgram(), resolver.getSymbols(), resolver.getLabelCount());
+		}
+	}
+	
+	if (stats != NULL)
+	{
+		AllocationCounter::stop();
+		stats->commands = result->words.size();
+		stats->symbols = result->symbols.size();
+		stats->lookups = result->symbols.getLookupCount();
+		stats->probes = result->symbols.getProbeCount();
+		stats->allocations = AllocationCounter::getCount();
+		stats->allocatedBytes = AllocationCounter::getBytes();
+		stats->peakRSS = AssemblyStats::currentPeakRSS();
+	}
+	return result->ok;
+}
+
+// Assembler:
+Assembler::Assembler()
+{
+	error = "";
+	sourceSize = 0;
+	wordCount = 0;
+	threads = 1;
+	format = Formatter::FORMAT_HACK;
+	optimizeOn = false;
+	removedCount = 0;
+	leanOn = false;
+	sourceMapOn = false;
+	listingOn = false;
+	statsOn = false;
+	cache = NULL;
+}
+
+Assembler::~Assembler(){}
+
+const char* const Assembler::VERSION = "1.1";
+
+/**
+ * Assembles the input at path. Once done, outputs the result to a .hack file in the same dir as the input path,
+ * a .rom file if the format is Formatter::FORMAT_ROM, or a .hobj object module if it is Formatter::FORMAT_OBJECT.
+ * If path is "-", the input is read from stdin and the result is written to stdout.
+ * A .hmap source map and a .lst listing are written next to it too, if they are on.
+ */
+ int Assembler::assemble(char* path)
+ {
+	error = "";
+	sourceSize = 0;
+	wordCount = 0;
+	removedCount = 0;
+	double start = statsOn ? AssemblyStats::now() : 0;
+	if (loadInput(path) == 1)
+	{
+		return 1;
+	}
+	double loaded = statsOn ? AssemblyStats::now() : 0;
+	sourceSize = input.getSize();
+	string outputPath = string(path); // Get input path.
+	if (outputPath != "-")
+		outputPath = outputPath.substr(0, outputPath.find_last_of(".")) + "." + Formatter::extension(format); // Change file extension to hack.
+	
+	// Unchanged sources come straight from the cache:
+	bool optimizing = optimizeOn && format != Formatter::FORMAT_OBJECT; // Objects keep every instruction for the link.
+	string kind = (optimizing ? "O." : "") + Formatter::extension(format);
+	bool mapping = sourceMapOn || listingOn;
+	if (mapping && (format == Formatter::FORMAT_OBJECT || optimizing || leanOn || outputPath == "-"))
+	{
+		input.close();
+		error = "A source map is only written for a named file, without optimizing, object output or lean mode";
+		return 1;
+	}
+	unsigned long long key = 0;
+	if (cache != NULL)
+		key = AssemblyCache::key(input.getData(), input.getSize());
+	if (cache != NULL && !mapping) // The map is not cached, so it needs the source assembled.
+	{
+		size_t outputSize = 0;
+		if (cache->fetch(key, kind, outputPath, &outputSize))
+		{
+			input.close();
+			if (format == Formatter::FORMAT_ROM)
+				wordCount = (outputSize - Formatter::ROM_HEADER_SIZE) / 2;
+			else if (format == Formatter::FORMAT_OBJECT) // Its size does not tell.
+				wordCount = 0;
+			else
+				wordCount = (outputSize + 1) / (Formatter::hackSize(1) + 1);
+			if (statsOn)
+			{
+				stats = AssemblyStats();
+				stats.loadSeconds = loaded - start;
+				stats.writeSeconds = AssemblyStats::now() - loaded;
+				stats.bytes = sourceSize;
+				stats.commands = wordCount;
+				stats.peakRSS = AssemblyStats::currentPeakRSS();
+				stats.cacheHit = true;
+			}
+			return 0;
+		}
+	}
+	
+	if (format == Formatter::FORMAT_OBJECT || optimizing)
+	{
+		int failed = assembleModule(outputPath, key, kind);
+		if (statsOn)
+			stats.loadSeconds = loaded - start;
+		return failed;
+	}
+	if (leanOn)
+	{
+		int failed = assembleLean(outputPath);
+		if (statsOn)
+			stats.loadSeconds = loaded - start;
+		return failed;
+	}
+	
+	// Logic:
+	AssemblyResult result;
+	context.setThreads(threads);
+	context.setStats(statsOn);
+	context.setSourceMap(mapping);
+	context.assemble(string_view(input.getData(), input.getSize()), &result);
+	string listing;
+	if (listingOn && result.ok)
+		listing = result.sourceMap.toListing(result.words, string_view(input.getData(), input.getSize()));
+	input.close(); // The source is no longer needed.
+	if (statsOn)
+	{
+		stats = result.stats;
+		stats.loadSeconds = loaded - start;
+	}
+	if (!result.ok)
+	{
+		error = "Line " + to_string(result.diagnostics[0].line) + ": " + result.diagnostics[0].message;
+		return 1;
+	}
+	wordCount = result.words.size();
+	double formatStart = statsOn ? AssemblyStats::now() : 0;
+	string output = Formatter::format(result.words, format);
+	double formatted = statsOn ? AssemblyStats::now() : 0;
+	
+	//Output:
+	if (Formatter::writeFile(outputPath, output.data(), output.size()) == 1)
+	{
+		error = "Could not write " + outputPath;
+		return 1;
+	}
+	if (cache != NULL)
+		cache->store(key, Formatter::extension(format), output.data(), output.size());
+	string stem = outputPath.substr(0, outputPath.find_last_of("."));
+	if (sourceMapOn && Formatter::writeFile(stem + ".hmap", result.sourceMap.getData(), result.sourceMap.getSize()) == 1)
+	{
+		error = "Could not write " + stem + ".hmap";
+		return 1;
+	}
+	if (listingOn && Formatter::writeFile(stem + ".lst", listing.data(), listing.size()) == 1)
+	{
+		error = "Could not write " + stem + ".lst";
+		return 1;
+	}
+	if (statsOn)
+	{
+		stats.formatSeconds = formatted - formatStart;
+		stats.writeSeconds = AssemblyStats::now() - formatted;
+		stats.peakRSS = AssemblyStats::currentPeakRSS();
+	}
+	return 0;
+ }
+ 
+/**
+ * Assembles this->input through an ObjectModule and writes it to outputPath: as it is for Formatter::FORMAT_OBJECT,
+ * or else through Optimizer.
+ *
+ * @param outputPath Where the output goes.
+ * @param key The cache key of the input, if there is a cache.
+ * @param kind The cache entry kind of the output.
+ * @return 0 on success, 1 on failure; see getError().
+ */
+ int Assembler::assembleModule(const string& outputPath, unsigned long long key, const string& kind)
+ {
+	double start = statsOn ? AssemblyStats::now() : 0;
+	ObjectModule module;
+	int failed = module.assemble(input.getData(), input.getSize());
+	input.close();
+	if (failed == 1)
+	{
+		error = "Line " + to_string(module.getErrorLine()) + ": " + module.getError();
+		return 1;
+	}
+	double encoded = statsOn ? AssemblyStats::now() : 0;
+	string output;
+	if (format == Formatter::FORMAT_OBJECT)
+	{
+		wordCount = module.getWords().size();
+		output = module.toObject();
+	}
+	else
+	{
+		Optimizer optimizer;
+		vector<uint16_t> words;
+		optimizer.optimize(module, &words);
+		wordCount = words.size();
+		removedCount = optimizer.getRemovedCount();
+		output = Formatter::format(words, format);
+	}
+	double formatted = statsOn ? AssemblyStats::now() : 0;
+	if (Formatter::writeFile(outputPath, output.data(), output.size()) == 1)
+	{
+		error = "Could not write " + outputPath;
+		return 1;
+	}
+	if (cache != NULL)
+		cache->store(key, kind, output.data(), output.size());
+	if (statsOn)
+	{
+		stats = AssemblyStats();
+		stats.encodeSeconds = encoded - start;
+		stats.formatSeconds = formatted - encoded; // Optimizing included.
+		stats.writeSeconds = AssemblyStats::now() - formatted;
+		stats.bytes = sourceSize;
+		stats.commands = wordCount;
+		stats.removed = removedCount;
+		stats.symbols = module.getSymbols().size();
+		stats.peakRSS = AssemblyStats::currentPeakRSS();
+	}
+	return 0;
+ }
+
+/**
+ * Assembles this->input with as little memory as it can and writes it to outputPath; see the class comment.
+ * The output is the same as assembling the usual way, but is not added to the cache, as it is never held whole.
+ *
+ * @param outputPath Where the output goes.
+ * @return 0 on success, 1 on failure; see getError().
+ */
+ int Assembler::assembleLean(const string& outputPath)
+ {
+	double start = statsOn ? AssemblyStats::now() : 0;
+	const char* source = input.getData();
+	size_t size = input.getSize();
+	SymbolTable symbols = SymbolTable::predefined();
+	vector<Instruction> commands;
+	vector<Label> labels;
+	string scratch;
+	int length;
+	
+	// Blocks end at the end of a line, so every block can be scanned on its own.
+	auto blockEnd = [&](size_t begin)
+	{
+		if (size - begin <= LEAN_BLOCK_SIZE)
+			return size;
+		const char* newLine = (const char*)memchr(source + begin + LEAN_BLOCK_SIZE, '\n', size - begin - LEAN_BLOCK_SIZE);
+		return (newLine == NULL) ? size : (size_t)(newLine - source) + 1;
+	};
+	
+	// First pass: the labels, as Resolver::tokenize adds them. The first declaration wins.
+	size_t count = 0;
+	int labelCount = 0;
+	int lines = 0;
+	for (size_t begin = 0; begin < size; )
+	{
+		size_t end = blockEnd(begin);
+		commands.clear();
+		labels.clear();
+		lines += Resolver::scan(source, begin, end, &commands, &labels);
+		for (size_t i = 0; i < labels.size(); i++)
+		{
+			const char* name = Resolver::compact(source + labels[i].start, labels[i].length, &scratch, &length);
+			if (Resolver::isNumber(name, length) || symbols.find(name, length) != SymbolTable::NOT_FOUND)
+				continue;
+			symbols.add(name, length, (int)count + labels[i].address);
+			labelCount++;
+		}
+		count += commands.size();
+		begin = end;
+	}
+	double scanned = statsOn ? AssemblyStats::now() : 0;
+	
+	// Second pass: encode straight into the words, numbering variables in first use order.
+	vector<uint16_t> words;
+	words.reserve(count);
+	int varCount = 0;
+	int lineBase = 0; // Lines before the block.
+	for (size_t begin = 0; begin < size; )
+	{
+		size_t end = blockEnd(begin);
+		commands.clear();
+		labels.clear();
+		int blockLines = Resolver::scan(source, begin, end, &commands, &labels);
+		for (size_t n = 0; n < commands.size(); n++)
+		{
+			const Instruction& command = commands[n];
+			const char* text = source + command.start;
+			if (command.kind == Instruction::A_COMMAND)
+			{
+				const char* name = Resolver::compact(text + 1, command.length - 1, &scratch, &length);
+				if (Resolver::isNumber(name, length))
+				{
+					words.push_back((uint16_t)Resolver::parseNumber(name, length));
+					continue;
+				}
+				int id = symbols.find(name, length);
+				if (id == SymbolTable::NOT_FOUND)
+					id = symbols.add(name, length, Resolver::VAR_ASSIGN_ADD_START + varCount++);
+				words.push_back((uint16_t)(symbols.getValue(id) & 0x7FFF));
+			}
+			else
+			{
+				const char* code = Resolver::compact(text, command.length, &scratch, &length);
+				int word = Interpreter::encodeC(code, length);
+				if (word == Interpreter::CODE_ERROR)
+				{
+					error = "Line " + to_string(lineBase + command.line) + ": Invalid command: " + string(code, length);
+					input.close();
+					return 1;
+				}
+				words.push_back((uint16_t)word);
+			}
+		}
+		lineBase += blockLines;
+		begin = end;
+	}
+	input.close(); // The source is no longer needed.
+	vector<Instruction>().swap(commands);
+	vector<Label>().swap(labels);
+	wordCount = words.size();
+	double encoded = statsOn ? AssemblyStats::now() : 0;
+	
+	if (writeLean(outputPath, words) == 1)
+	{
+		error = "Could not write " + outputPath;
+		return 1;
+	}
+	if (statsOn)
+	{
+		stats = AssemblyStats();
+		stats.scanSeconds = scanned - start;
+		stats.encodeSeconds = encoded - scanned;
+		stats.writeSeconds = AssemblyStats::now() - encoded; // Formatting included.
+		stats.bytes = sourceSize;
+		stats.lines = lines + 1;
+		stats.commands = wordCount;
+		stats.labels = labelCount;
+		stats.variables = varCount;
+		stats.symbols = symbols.size();
+		stats.lookups = symbols.getLookupCount();
+		stats.probes = symbols.getProbeCount();
+		stats.peakRSS = AssemblyStats::currentPeakRSS();
+	}
+	return 0;
+ }
+
+/**
+ * Formats words and writes them to outputPath a block of LEAN_FORMAT_WORDS at a time, 
+ * so the whole output is never held.
+ *
+ * @param outputPath Where the output goes, or "-" for stdout.
+ * @param words The hack code.
+ * @return 0 on success, 1 if the file could not be written.
+ */
+ int Assembler::writeLean(const string& outputPath, const vector<uint16_t>& words)
+ {
+	FILE* file = (outputPath == "-") ? stdout : fopen(outputPath.c_str(), "wb");
+	if (file == NULL)
+		return 1;
+	bool failed = false;
+	string block;
+	if (format == Formatter::FORMAT_ROM)
+	{
+		block.resize(LEAN_FORMAT_WORDS * 2);
+		char header[Formatter::ROM_HEADER_SIZE];
+		Formatter::writeROMHeader(words.data(), words.size(), header);
+		failed |= (fwrite(header, 1, sizeof(header), file) != sizeof(header));
+		for (size_t at = 0; at < words.size() && !failed; at += LEAN_FORMAT_WORDS)
+		{
+			size_t count = min((size_t)LEAN_FORMAT_WORDS, words.size() - at);
+			for (size_t i = 0; i < count; i++)
+			{
+				block[2 * i] = (char)words[at + i];
+				block[2 * i + 1] = (char)(words[at + i] >> 8);
+			}
+			failed |= (fwrite(block.data(), 1, count * 2, file) != count * 2);
+		}
+	}
+	else
+	{
+		block.resize(Formatter::hackSize(LEAN_FORMAT_WORDS) + 1);
+		for (size_t at = 0; at < words.size() && !failed; at += LEAN_FORMAT_WORDS)
+		{
+			size_t count = min((size_t)LEAN_FORMAT_WORDS, words.size() - at);
+			size_t bytes = Formatter::hackSize(count);
+			Formatter::writeHack(words.data() + at, count, &block[0]);
+			if (at + count < words.size()) // Lines are only between words.
+				block[bytes++] = '\n';
+			failed |= (fwrite(block.data(), 1, bytes, file) != bytes);
+		}
+	}
+	if (file == stdout)
+		failed |= (fflush(file) != 0);
+	else
+		failed |= (fclose(file) != 0);
+	return failed ? 1 : 0;
+ }
+
+/**
+ * Load file at input into this->input.
+ *
+ * @param input The path as a char*, or "-" for stdin.
+ */
+ int Assembler::loadInput(char* path)
+ {
+	if (input.open(path) == 1) // If path does not open properly.
+	{
+		error = "Path invalid; Usage: hackAssembler (path to .asm file)";
+		return 1;
+	}
+	return 0;
+ }
+
+/**
+ * Sets the number of threads a single large source is assembled on. The default is 1.
+ *
+ * @param threads The number of threads.
+ */
+ void Assembler::setThreads(int threads)
+ {
+	 this->threads = threads;
+ }
+
+/**
+ * Makes the following calls to assemble look up their output in cache first, and add it there after.
+ *
+ * @param cache The cache, which must outlive the calls; NULL for none.
+ */
+void Assembler::setCache(AssemblyCache* cache)
+{
+	this->cache = cache;
+	return;
+}
+
+/**
+ * Sets the output format of the following calls to assemble.
+ *
+ * @param format Formatter::FORMAT_HACK, the default, FORMAT_ROM or FORMAT_OBJECT.
+ */
+void Assembler::setFormat(int format)
+{
+	this->format = format;
+	return;
+}
+
+/**
+ * Turns Optimizer on or off for the following calls to assemble. Object modules are never optimized.
+ *
+ * @param on true to leave out instructions that do nothing.
+ */
+void Assembler::setOptimize(bool on)
+{
+	optimizeOn = on;
+	return;
+}
+
+/**
+ * Turns lean mode on or off for the following calls to assemble; see the class comment.
+ * It applies to .hack and ROM output without -O, which are not added to the cache in lean mode.
+ *
+ * @param on true to keep the peak memory near the size of the source.
+ */
+void Assembler::setLean(bool on)
+{
+	leanOn = on;
+	return;
+}
+
+/**
+ * Turns the .hmap source map on or off for the following calls to assemble; see SourceMap.
+ * It applies to .hack and ROM output of a named file without -O or lean mode, which then skips the cache.
+ *
+ * @param on true to write the map next to the output.
+ */
+void Assembler::setSourceMap(bool on)
+{
+	sourceMapOn = on;
+	return;
+}
+
+/**
+ * Turns the .lst listing on or off for the following calls to assemble; see SourceMap::toListing.
+ * It applies where setSourceMap does.
+ *
+ * @param on true to write the listing next to the output.
+ */
+void Assembler::setListing(bool on)
+{
+	listingOn = on;
+	return;
+}
+
+/**
+ * Gets the number of instructions Optimizer took out in the last call to assemble.
+ * It is 0 if the output came from the cache.
+ *
+ * @return The number of instructions.
+ */
+size_t Assembler::getRemovedCount()
+{
+	return removedCount;
+}
+
+/**
+ * Turns stats on or off for the following calls to assemble. They are off by default, and cost nothing then.
+ *
+ * @param on true to fill in getStats().
+ */
+void Assembler::setStats(bool on)
+{
+	statsOn = on;
+	return;
+}
+
+/**
+ * Gets the stats of the last call to assemble, if they were on.
+ *
+ * @return The stats.
+ */
+const AssemblyStats& Assembler::getStats()
+{
+	return stats;
+}
+
+/**
+ * Gets the reason the last call to assemble failed.
+ *
+ * @return The error message, or an empty string if it succeeded.
+ */
+ string Assembler::getError()
+ {
+	 return error;
+ }
+
+/**
+ * @return The number of chars in the last assembled source.
+ */
+ size_t Assembler::getSourceSize()
+ {
+	 return sourceSize;
+ }
+
+/**
+ * @return The number of hack commands in the last assembled program.
+ */
+ size_t Assembler::getWordCount()
+ {
+	 return wordCount;
+ }
@@ -1,113 +1,1113 @@
-/************************************************************************-
- *	hackAsm.h, contains the classes to build the HACK Assembler.
- *
- *	Started: December 15
- *  Finished: December 22
- *  Updates:
- *		- 
- *	©2018 C. A. Acred all rights reserved.
- ----------------------------------------------------------*
-*/
-
-#ifndef HACKASM_H
-#define HACKASM_H
-
-#include <cstdlib>
-#include <string>
-#include <vector>
-
-using namespace std;
-
-class Resolver;
-class Interpreter;
-class Assembler;
-
-/**
- * Resolves Labels and variables in the asm code. 
- * Removes whitespace and comments.
- * Saves resulting string in this->output.
- */
-class Resolver
-{
-private:
-    const string EMPTY_STR = "";
-    const int VAR_ASSIGN_ADD_START = 16; // Starting register number for vars.
-    
-    int commandCount;
-    int varCounter;
-	int lineCounter;
-    
-    vector<string> varNames; // Names of variables 
-    vector<string> varRegNums; // Corresponding register numbers.
-    string output;
-    
-public:
-    Resolver(string* input);
-    ~Resolver();
-	
-	bool isNumber(string* input);
-    
-    string addVar(string name, bool isLabel);
-	string addVar(string name, int reg);
-	string resolveVar(string name, bool isLabel);
-	string findVar(string name);
-    
-    string getOutput();
-	
-	void initializeVars();
-	
-	string resolveLabels(string* input);
-	string resolveExcess(string* input);
-	string resolveSymbols(string* input);
-};
-
-
-/**
- * Interprets asm code to .hack machine code.
- */
-class Interpreter
-{
-private:
-    vector<vector<string>> desCode; 
-    vector<vector<string>> JMPCode;
-    vector<vector<string>> compCode;
-	
-	string output;
-	
-	string getDesCode(string input);
-	string getCompCode(string input);
-	string getJMPCode(string input);
-	
-	void initializeCode();
-    
-public:
-    Interpreter(string* input);
-    ~Interpreter();
-	
-	string getOutput();
-};
-
-/**
- * Resolves and interprets asm code into hack code. 
- * Uses a Resolver for cleaning up the code of comment and whitespace and for resolving symbolic variables. 
- * Uses a Interpreter to change the asm code to hack machine code.
- * Saves this resulting hack code in a file of the same name in the same directory as the input path.
- */
- class Assembler 
- {
-private: 
-	string input; 
-	
-	int loadInput(char* input);
-	
-public:
-	Assembler();
-	~Assembler();
-	
-	int assemble(char* input);
-	 
-	static vector<string> getLine(string* input, int start);
-    static vector<string> getLine(string* input, int start, char endChar);
- };
-
+/************************************************************************-
+ *	hackAsm.h, contains the classes to build the HACK Assembler.
+ *
+ *	Started: December 15
+ *  Finished: December 22
+ *  Updates:
+ *		- 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+
+#ifndef HACKASM_H
+#define HACKASM_H
+
+#include <cstdlib>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <string_view>
+
+using namespace std;
+
+class SymbolTable;
+class Scanner;
+class Resolver;
+class Program;
+class Interpreter;
+class Formatter;
+class Source;
+class Assembler;
+class WorkPool;
+class Batch;
+class ParallelAssembler;
+class AssemblyContext;
+struct AssemblyStats;
+class AssemblyCache;
+class AssemblyServer;
+class AssemblyClient;
+class StreamAssembler;
+class IncrementalAssembler;
+class ObjectModule;
+class Linker;
+class Optimizer;
+class Executor;
+class Disassembler;
+class SourceMap;
+
+/**
+ * A single asm command found by Resolver::tokenize. 
+ * Points into the source instead of copying it; start and length exclude 
+ * leading/trailing whitespace and comments, but may still contain inner whitespace.
+ */
+struct Instruction
+{
+	static const int A_COMMAND = 0;
+	static const int C_COMMAND = 1;
+	
+	size_t start; // Offset of the command's first char in the source.
+	int length;   // Number of chars in the command.
+	int kind;     // A_COMMAND or C_COMMAND.
+	int line;     // Line number in the source, starting at 1.
+};
+
+/**
+ * A label declaration found by Resolver::scan.
+ */
+struct Label
+{
+	size_t start; // Offset of the first char of the label's name in the source.
+	int length;   // Number of chars in the name; may still contain inner whitespace.
+	int address;  // Number of commands before the label in the scanned range.
+};
+
+/**
+ * Symbol names and their register/ROM numbers. 
+ * Names are copied into one pool, an arena that outlives the source, and found through an open addressing hash table 
+ * (linear probing), so looking up a symbol never allocates.
+ * Every symbol gets an id, its index in the order it was added.
+ */
+class SymbolTable
+{
+private:
+	struct Symbol
+	{
+		uint32_t hash;
+		int nameStart; // Offset of the name in namePool.
+		int nameLength;
+		int value;
+	};
+	
+	string namePool;        // All names, back to back.
+	vector<Symbol> symbols; // Indexed by symbol id.
+	vector<int> slots;      // Hash table of symbol id + 1; 0 is an empty slot. Size is a power of two.
+	
+	mutable long long lookupCount;
+	mutable long long probeCount;
+	
+	static uint32_t hash(const char* name, int length);
+	int probe(const char* name, int length, long long* probes) const;
+	void grow();
+	
+public:
+	static const int NOT_FOUND = -1;
+	
+	SymbolTable();
+	
+	int find(const char* name, int length) const;
+	int lookup(const char* name, int length) const;
+	int add(const char* name, int length, int value);
+	
+	int getValue(int id) const;
+	void setValue(int id, int value);
+	string_view getName(int id) const;
+	int size() const;
+	
+	long long getLookupCount() const;
+	long long getProbeCount() const;
+	
+	static const SymbolTable& predefined();
+};
+
+/**
+ * Finds the commands and label declarations in asm code, for Resolver::scan.
+ * On x86 it classifies 32 chars at a time into bit masks of new lines, whitespace and '/' with SSE2 or AVX2, 
+ * picked at runtime, and walks the masks line by line; elsewhere it looks at one char at a time.
+ */
+class Scanner
+{
+public:
+	static const int MODE_SCALAR = 0;
+	static const int MODE_SSE2 = 1;
+	static const int MODE_AVX2 = 2;
+	
+private:
+	static const size_t BLOCK_SIZE = 32;  // Chars per mask.
+	static const size_t GROUP_SIZE = 128; // Masks classified per call.
+	
+	typedef void (*Classifier)(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes);
+	
+	static int mode;
+	
+	static void classifyScalar(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes);
+	static void classifySSE2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes);
+	static void classifyAVX2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes);
+	
+	static int scanScalar(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels);
+	static int scanMasks(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels, Classifier classify);
+	static void emit(const char* source, size_t start, size_t last, int line, int* count, vector<Instruction>* commands, vector<Label>* labels);
+	
+public:
+	static int scan(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels);
+	
+	static int getMode();
+	static int bestMode();
+	static void setMode(int mode);
+};
+
+/**
+ * Resolved commands, as Resolver hands them to Interpreter: one column per field, so a pass over
+ * one field reads only that field, and encoding streams through the columns in ROM order.
+ * Command n is kinds[n], comps[n], dests[n], jumps[n], values[n], symbols[n] and lines[n].
+ * C commands that are not valid are kept as INVALID, so the error is found in order when encoding.
+ */
+class Program
+{
+public:
+	static const uint8_t INVALID = 2; // A kind besides Instruction::A_COMMAND and C_COMMAND.
+	
+	vector<uint8_t> kinds;
+	vector<uint8_t> comps;   // The 7 comp bits of a C command, a bit first.
+	vector<uint8_t> dests;   // The 3 dest bits of a C command.
+	vector<uint8_t> jumps;   // The 3 jump bits of a C command.
+	vector<int> values;      // The 15 bit number an A command loads, or for INVALID the index of its text in invalid.
+	vector<int> symbols;     // The symbol id an A command names in Resolver's table, or SymbolTable::NOT_FOUND for a number.
+	vector<int> lines;       // Line number in the source, starting at 1.
+	vector<string> invalid;  // The commands that are not valid, without whitespace.
+	
+	void clear();
+	void reserve(size_t count);
+	size_t size() const;
+	
+	void addA(int value, int symbol, int line);
+	void addC(int comp, int dest, int jump, int line);
+	void addInvalid(const char* text, int length, int line);
+};
+
+/**
+ * Resolves Labels and variables in the asm code. 
+ * Removes whitespace and comments.
+ * Saves the resulting commands in this->program.
+ *
+ * The source is scanned once by tokenize(), which records every command as an Instruction
+ * and adds every label with its ROM address. resolveSymbols() then walks the instruction list,
+ * replacing symbols with their numbers and splitting C commands into their fields.
+ */
+class Resolver
+{
+private:
+    const string EMPTY_STR = "";
+    
+    int commandCount;
+    int varCounter;
+	int lineCounter;
+	int labelCount;   // Labels added by tokenize.
+	int newLineCount; // Lines in the source, less one.
+    
+    SymbolTable symbols; // Built-in symbols, labels and variables.
+    vector<Instruction> instructions; // Commands found by tokenize, in ROM order.
+    Program program;
+    
+public:
+    static const int VAR_ASSIGN_ADD_START = 16; // Starting register number for vars.
+    
+    Resolver();
+    Resolver(const char* source, size_t size);
+    ~Resolver();
+	
+	void resolve(const char* source, size_t size, AssemblyStats* stats = NULL);
+	
+	static bool isNumber(const char* input, int length);
+	static bool isBlank(char c);
+	static int parseNumber(const char* input, int length);
+	static const char* compact(const char* text, int length, string* scratch, int* compactLength);
+    
+    int addVar(const char* name, int length, bool isLabel);
+	int resolveVar(const char* name, int length, bool isLabel);
+	int findVar(const char* name, int length);
+    
+    const SymbolTable& getSymbols();
+    const vector<Instruction>& getInstructions();
+    int getVarCount();
+    int getLabelCount();
+    int getNewLineCount();
+    const Program& getProgram();
+	
+	void initializeVars();
+	
+	void tokenize(const char* source, size_t size);
+	static int scan(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels);
+	void resolveSymbols(const char* source);
+};
+
+
+/**
+ * Interprets resolved commands to HACK machine code, one 16 bit word per command.
+ * Formatter turns the words into a .hack file.
+ *
+ * The comp, dest and jump tables are switches on the packed chars of each field, 
+ * built by the compiler; nothing is set up at runtime.
+ */
+class Interpreter
+{
+private:
+	vector<uint16_t> words;
+	string error;
+	int errorCommand;
+	
+	static constexpr uint32_t pack(char a, char b = 0, char c = 0)
+	{
+		return (uint32_t)(unsigned char)a | (uint32_t)(unsigned char)b << 8 | (uint32_t)(unsigned char)c << 16;
+	}
+	static uint32_t pack(const char* input, int length);
+    
+public:
+	static const int CODE_ERROR = -1;
+	
+    Interpreter();
+    Interpreter(const Program* input);
+    ~Interpreter();
+	
+	int interpret(const Program* input);
+	
+	static int getDesCode(const char* input, int length);
+	static int getCompCode(const char* input, int length);
+	static int getJMPCode(const char* input, int length);
+	static int splitC(const char* input, int length, int* comp, int* dest, int* jump);
+	static int encodeC(const char* input, int length);
+	
+	const vector<uint16_t>& getWords();
+	string getError();
+	int getErrorCommand();
+};
+
+/**
+ * Writes encoded words in the output formats.
+ * FORMAT_HACK is .hack text: a line of 16 '0'/'1' chars per word.
+ * FORMAT_ROM is a binary ROM image a simulator can map and use as is:
+ *     offset 0   "HROM"
+ *     offset 4   uint16 version, 1
+ *     offset 6   uint16 header size, 16
+ *     offset 8   uint32 word count
+ *     offset 12  uint32 Fletcher-32 checksum of the words
+ *     offset 16  the words, uint16 each
+ * Every number is little-endian.
+ */
+class Formatter
+{
+private:
+	static const char (*bitChars())[8];
+	
+public:
+	static const int FORMAT_HACK = 0;
+	static const int FORMAT_ROM = 1;
+	static const int FORMAT_OBJECT = 2; // An ObjectModule, for Linker; not made by format().
+	static const size_t ROM_HEADER_SIZE = 16;
+	
+	static size_t hackSize(size_t wordCount);
+	static void writeHack(const uint16_t* words, size_t count, char* out);
+	static string toHack(const vector<uint16_t>& words);
+	
+	static size_t romSize(size_t wordCount);
+	static void writeROM(const uint16_t* words, size_t count, char* out);
+	static void writeROMHeader(const uint16_t* words, size_t count, char* out);
+	static string toROM(const vector<uint16_t>& words);
+	static int readROM(const char* data, size_t size, vector<uint16_t>* words);
+	static int readHack(const char* data, size_t size, vector<uint16_t>* words);
+	static uint32_t checksum(const uint16_t* words, size_t count);
+	
+	static string format(const vector<uint16_t>& words, int format);
+	static string extension(int format);
+	
+	static int writeFile(const string& path, const char* data, size_t size);
+};
+
+/**
+ * Read-only view of an asm file's contents.
+ * Regular files are memory mapped, so they are parsed where they lie without being copied.
+ * Anything that cannot be mapped (stdin, pipes) is read into a buffer sized up front when possible.
+ */
+class Source
+{
+private:
+	const char* data;
+	size_t size;
+	string buffer; // Holds the contents when they could not be mapped.
+	void* mapping; // Start of the mapped view, or NULL.
+	
+	int readAll(int fd, size_t sizeHint);
+	
+	Source(const Source&);
+	Source& operator=(const Source&);
+	
+public:
+	Source();
+	~Source();
+	
+	int open(const char* path);
+	void close();
+	
+	const char* getData() const;
+	size_t getSize() const;
+};
+
+/**
+ * Where each ROM address, label and variable of a program came from, as a .hmap file for profilers and debuggers.
+ * Built from Resolver's Program and symbols in the same pass as the hack code, and laid out to be mapped and
+ * searched in place, every number a little-endian uint32:
+ *     offset 0   "HMAP"
+ *     offset 4   uint16 version, 1
+ *     offset 6   uint16 header size, 24
+ *     offset 8   word count, label count, variable count, name bytes
+ *     then       the source line of each ROM address, in address order, so also in line order
+ *     then       the labels sorted by name: name offset, name length, ROM address; then their indexes sorted by address
+ *     then       the variables sorted by name: name offset, name length, register; then their indexes sorted by register
+ *     then       the names, back to back
+ */
+class SourceMap
+{
+private:
+	string data;          // The file, when built or read into this map.
+	const char* external; // The file, when viewed in place; NULL otherwise.
+	size_t wordCount;
+	size_t labelCount;
+	size_t variableCount;
+	size_t nameBytes;
+	
+	const unsigned char* base() const;
+	uint32_t number(size_t offset) const;
+	string_view entryName(size_t table, size_t index) const;
+	int find(size_t table, size_t count, const char* name, int length) const;
+	int findAt(size_t table, size_t count, int value) const;
+	size_t linesAt() const;
+	size_t labelsAt() const;
+	size_t variablesAt() const;
+	
+public:
+	static const size_t HEADER_SIZE = 24;
+	
+	SourceMap();
+	
+	void build(const Program& program, const SymbolTable& symbols, int labelCount);
+	int read(const char* data, size_t size, bool inPlace);
+	const char* getData() const;
+	size_t getSize() const;
+	
+	int getLine(int address) const;
+	int findAddress(int line) const;
+	int findLabel(const char* name, int length) const;
+	int findVariable(const char* name, int length) const;
+	string_view labelAt(int address) const;
+	string_view variableAt(int address) const;
+	
+	size_t getWordCount() const;
+	size_t getLabelCount() const;
+	size_t getVariableCount() const;
+	
+	string toListing(const vector<uint16_t>& words, string_view source) const;
+};
+
+/**
+ * Measurements of one assembly, for finding out where the time goes.
+ * Only filled in when asked for, through AssemblyContext::setStats or Assembler::setStats;
+ * otherwise nothing is timed or counted.
+ */
+struct AssemblyStats
+{
+	// Wall time of each stage, in seconds.
+	double loadSeconds;
+	double scanSeconds;    // Finding commands and labels: Resolver::tokenize.
+	double resolveSeconds; // Replacing symbols: Resolver::resolveSymbols.
+	double encodeSeconds;  // Interpreter.
+	double formatSeconds;
+	double writeSeconds;
+	
+	size_t bytes;    // Size of the source.
+	size_t lines;
+	size_t commands;
+	size_t removed;  // Commands taken out by Optimizer.
+	
+	int labels;
+	int variables; // Added by Resolver::addVar.
+	int symbols;   // Built-in symbols, labels and variables.
+	long long lookups;
+	long long probes;
+	
+	long long allocations;    // Heap allocations by the assembling thread, or AllocationCounter::NOT_COUNTED.
+	long long allocatedBytes;
+	size_t peakRSS;           // Peak resident memory of the process so far, in bytes.
+	bool cacheHit;            // The output came from an AssemblyCache, so nothing was parsed.
+	
+	AssemblyStats();
+	
+	string toJSON(const string& path) const;
+	
+	static double now();
+	static size_t currentPeakRSS();
+};
+
+/**
+ * Counts heap allocations made through operator new, while switched on.
+ * Each thread has its own count, so it leaves out the threads a ParallelAssembler starts.
+ * operator new is only replaced in builds with HACK_COUNT_ALLOCATIONS defined, so other builds pay nothing
+ * for it, and their counts are NOT_COUNTED.
+ */
+class AllocationCounter
+{
+public:
+	static const long long NOT_COUNTED = -1;
+	
+	static bool isCounting();
+	static void start();
+	static void stop();
+	static long long getCount();
+	static long long getBytes();
+};
+
+/**
+ * A problem found while assembling.
+ */
+struct Diagnostic
+{
+	int line;       // Line number in the source, starting at 1; 0 if it is not about one line.
+	string message;
+};
+
+/**
+ * Everything AssemblyContext::assemble produces.
+ */
+struct AssemblyResult
+{
+	bool ok;
+	vector<uint16_t> words;         // The hack code, one word per command. Empty if !ok.
+	SymbolTable symbols;            // Built-in symbols, labels and variables.
+	vector<Diagnostic> diagnostics; // Empty if ok.
+	AssemblyStats stats;            // Only filled in if the context's stats are on.
+	SourceMap sourceMap;            // Only built if the context's source map is on.
+};
+
+/**
+ * Assembles programs held in memory, without touching files or printing anything.
+ * Keeps its Resolver and Interpreter, and their buffers, between calls, so assembling many small
+ * programs with one context does not reallocate. A context must only be used by one thread at a time.
+ */
+class AssemblyContext
+{
+private:
+	Resolver resolver;
+	Interpreter interpreter;
+	int threads;
+	bool statsOn;
+	bool sourceMapOn;
+	
+public:
+	AssemblyContext();
+	
+	AssemblyResult assemble(string_view source);
+	bool assemble(string_view source, AssemblyResult* result);
+	
+	void setThreads(int threads);
+	void setStats(bool on);
+	void setSourceMap(bool on);
+};
+
+/**
+ * Resolves and interprets asm code into hack code. 
+ * Uses a Resolver for cleaning up the code of comment and whitespace and for resolving symbolic variables. 
+ * Uses a Interpreter to change the asm code to hack machine code.
+ * Saves this resulting hack code in a file of the same name in the same directory as the input path.
+ *
+ * In lean mode (setLean) the peak memory is about the source, 2 bytes per instruction and the symbol table:
+ * the source is scanned a block at a time, once for the labels and once to encode, straight into the words,
+ * and is released before the output is formatted and written a block at a time.
+ */
+ class Assembler 
+ {
+private: 
+	Source input; 
+	AssemblyContext context; // Kept between calls, so its buffers are reused.
+	string error;
+	size_t sourceSize;
+	size_t wordCount;
+	int threads; // Threads to assemble one large source on.
+	int format;  // Formatter::FORMAT_HACK, FORMAT_ROM or FORMAT_OBJECT.
+	bool optimizeOn;
+	size_t removedCount;
+	bool leanOn;
+	bool sourceMapOn;
+	bool listingOn;
+	bool statsOn;
+	AssemblyStats stats;
+	AssemblyCache* cache; // Not owned; NULL for no cache.
+	
+	int loadInput(char* input);
+	int assembleModule(const string& outputPath, unsigned long long key, const string& kind);
+	int assembleLean(const string& outputPath);
+	int writeLean(const string& outputPath, const vector<uint16_t>& words);
+	
+public:
+	static const char* const VERSION; // Change whenever the output for the same source changes.
+	static const size_t LEAN_BLOCK_SIZE = 1 << 18;   // Bytes of source scanned at a time in lean mode.
+	static const size_t LEAN_FORMAT_WORDS = 1 << 16; // Words formatted at a time in lean mode.
+	
+	Assembler();
+	~Assembler();
+	
+	int assemble(char* input);
+	void setThreads(int threads);
+	void setCache(AssemblyCache* cache);
+	void setFormat(int format);
+	void setOptimize(bool on);
+	void setLean(bool on);
+	void setSourceMap(bool on);
+	void setListing(bool on);
+	
+	string getError();
+	size_t getSourceSize();
+	size_t getWordCount();
+	size_t getRemovedCount();
+	
+	void setStats(bool on);
+	const AssemblyStats& getStats();
+ };
+
+/**
+ * An on disk cache of assembled output, so unchanged sources are not assembled again.
+ * Entries are named by a hash of the source and Assembler::VERSION, and hold the output as written.
+ * Entries are written to a temporary file and renamed into place, so several processes can share a cache.
+ * When the entries grow past the size limit, the least recently used are removed.
+ */
+class AssemblyCache
+{
+private:
+	string directory;
+	unsigned long long maxSize;
+	unsigned long long totalSize; // Of the entries, as last counted plus what was stored since.
+	bool counted;
+	mutex lock; // For totalSize, as a Batch shares one cache between threads.
+	
+	string entryPath(unsigned long long key, const string& kind);
+	void evict();
+	
+	static int makeDirectories(const string& path);
+	
+public:
+	static const unsigned long long DEFAULT_MAX_SIZE = 256ULL << 20;
+	
+	AssemblyCache();
+	
+	int open(const string& directory, unsigned long long maxSize);
+	
+	bool fetch(unsigned long long key, const string& kind, const string& outputPath, size_t* size);
+	void store(unsigned long long key, const string& kind, const char* data, size_t size);
+	
+	const string& getDirectory();
+	
+	static unsigned long long hash(const char* data, size_t size, unsigned long long seed);
+	static unsigned long long key(const char* source, size_t size);
+	static string defaultDirectory();
+};
+
+/**
+ * Runs a list of tasks over a fixed number of threads.
+ * Every thread gets its own queue, dealt largest task first so the queues finish at about the same time.
+ * A thread whose queue is empty steals the smallest task left at the back of another thread's queue.
+ */
+class WorkPool
+{
+private:
+	struct Queue
+	{
+		mutex lock;
+		deque<size_t> tasks;
+	};
+	
+	int threadCount;
+	
+	static bool take(Queue* queue, bool fromFront, size_t* task);
+	
+public:
+	WorkPool(int threads);
+	
+	void run(const vector<size_t>& costs, const function<void(size_t task, int thread)>& work);
+	int getThreadCount();
+	int getThreadsPerTask(size_t taskCount);
+	
+	static int defaultThreadCount();
+};
+
+/**
+ * Assembles many asm files in one run, spread over a WorkPool.
+ * Every .hack file is written next to its input, as Assembler does for a single file.
+ */
+class Batch
+{
+private:
+	vector<string> paths;
+	vector<size_t> sizes; // Size of each file in bytes, used to balance the threads.
+	set<string> expanded; // Canonical paths of the files, directories and @files added, so each is only added once.
+	AssemblyCache* cache;
+	int format;
+	bool optimizeOn;
+	bool leanOn;
+	bool sourceMapOn;
+	bool listingOn;
+	
+	int addFile(const string& path, bool mustBeAsm);
+	int addDirectory(const string& path);
+	int addList(const string& path);
+	bool expand(const string& path);
+	
+public:
+	Batch();
+	
+	int add(const string& arg);
+	void setCache(AssemblyCache* cache);
+	void setFormat(int format);
+	void setOptimize(bool on);
+	void setLean(bool on);
+	void setSourceMap(bool on);
+	void setListing(bool on);
+	const vector<string>& getPaths();
+	int run(int threads, bool printStats);
+	
+	size_t getFileCount();
+};
+
+/**
+ * Assembles one large source on several threads, with exactly the same result as Resolver and Interpreter.
+ * The source is split into chunks at line boundaries, and each chunk is scanned on its own.
+ * A prefix sum of the command counts gives every chunk its ROM base, so the label tables can be merged in order.
+ * Each chunk is then encoded on its own, except for variables: those get their registers in one 
+ * ordered pass over the chunks, so they are numbered in first use order from 16 as Resolver::addVar does.
+ */
+class ParallelAssembler
+{
+private:
+	struct Chunk
+	{
+		size_t begin;
+		size_t end;
+		int base; // ROM address of the chunk's first command.
+		vector<Instruction> commands;
+		vector<Label> labels;
+		SymbolTable unresolved; // Symbols that are not labels or built in, in first use order. Values are set when merged.
+		vector<pair<int, int>> pending; // Command number and unresolved id of each A command using a variable.
+		int newLines; // Number of new lines in the chunk.
+		string error;
+		int errorLine; // Line of the invalid command, counted from the chunk's first line.
+	};
+	
+	int threadCount;
+	string error;
+	int errorLine;
+	SymbolTable symbols;
+	
+	void split(const char* source, size_t size, vector<Chunk>* chunks);
+	void encode(const char* source, Chunk* chunk, vector<uint16_t>* words);
+	
+public:
+	static const size_t MIN_CHUNK_SIZE = 1 << 20; // Smaller chunks are not worth a thread.
+	
+	ParallelAssembler(int threads);
+	
+	int assemble(const char* source, size_t size, vector<uint16_t>* words, AssemblyStats* stats = NULL);
+	
+	string getError();
+	int getErrorLine();
+	const SymbolTable& getSymbols();
+};
+
+/**
+ * Keeps assemblers warm in one process, serving requests over a Unix domain socket.
+ * Each connection gets its own thread and Assembler; a batch is spread over the server's threads.
+ * Every request is one line, answered in order, so a client may send many before reading:
+ *     ASSEMBLE path       Assembles the file at path to its .hack file.   Answer: OK 0
+ *     BATCH n             Followed by n lines of paths, assembled at once. Answer: n answers, in order.
+ *     SOURCE n            Followed by n bytes of asm code.               Answer: OK size, then the hack code.
+ *     SHUTDOWN            Stops the server.                              Answer: OK 0
+ * A failed request is answered with ERROR size, then the message. A BATCH or SOURCE count that is not a number
+ * or is above its limit, or a line longer than MAX_LINE_LENGTH, is answered with an ERROR, and the connection
+ * is then closed.
+ * Not supported on Windows.
+ */
+class AssemblyServer
+{
+private:
+	string socketPath;
+	int threads;
+	AssemblyCache* cache; // Not owned; NULL for no cache.
+	int listener;
+	bool stopping;
+	vector<int> connections;      // Open connections, closed on stop.
+	mutex lock;                   // For stopping and connections.
+	condition_variable finished; // Signalled when a connection closes.
+	string error;
+	
+	void serve(int connection);
+	int assembleBatch(const vector<string>& paths, vector<string>* errors);
+	void stop();
+	
+public:
+	static const unsigned long long MAX_BATCH_FILES = 1 << 20;
+	static const unsigned long long MAX_SOURCE_SIZE = 1ULL << 30;
+	static const size_t MAX_LINE_LENGTH = 4096 + 16; // A path of Linux's PATH_MAX after the request's name.
+	
+	AssemblyServer();
+	
+	int run(const string& socketPath);
+	void setThreads(int threads);
+	void setCache(AssemblyCache* cache);
+	string getError();
+	
+	static string defaultSocketPath();
+};
+
+/**
+ * Sends requests to an AssemblyServer. See AssemblyServer for the protocol.
+ * Not supported on Windows.
+ */
+class AssemblyClient
+{
+private:
+	int connection;
+	string buffer; // Received; the bytes from start on are not yet read.
+	size_t start;
+	string error;
+	
+	int send(const string& data);
+	int readAnswer(string* payload, bool* ok);
+	
+public:
+	AssemblyClient();
+	~AssemblyClient();
+	
+	int connect(const string& socketPath);
+	void close();
+	
+	int assemble(const vector<string>& paths, vector<string>* errors);
+	int assembleSource(string_view source, string* output);
+	int shutdown();
+	string getError();
+};
+
+/**
+ * Assembles asm code as it arrives, such as from a pipe, writing .hack text as it goes.
+ * Only a block of text is held at a time. A commands using a symbol that is not known yet are held as fixups
+ * until the label is declared; words are written in blocks once every word before them is settled.
+ * A symbol that is never declared is a variable, whose register depends on the order of first use,
+ * so it is only known at the end; the words from its first use on are held until then, as 2 bytes each.
+ */
+class StreamAssembler
+{
+private:
+	struct Fixup
+	{
+		size_t word; // Index of the word to patch.
+		int next;    // The symbol's next fixup, or -1.
+	};
+	
+	SymbolTable symbols;    // Built-in symbols, labels and, at the end, variables.
+	SymbolTable unresolved; // Symbols used before being declared, in first use order. Value is NOT_FOUND until known.
+	vector<int> fixupHeads; // First fixup of each unresolved symbol, or -1.
+	vector<Fixup> fixups;   // Settled ones are chained from freeFixup, to be reused.
+	int freeFixup;
+	
+	deque<uint16_t> held; // Words not yet written, from word flushed on.
+	deque<char> settled;  // Whether each held word is final.
+	size_t flushed;       // Words written.
+	size_t ready;         // Settled words at the front of held.
+	size_t wordCount;
+	size_t maxHeld;
+	int lineBase; // Lines before the block being read.
+	FILE* output;
+	string text; // Formatting buffer.
+	string error;
+	int errorLine;
+	
+	int encodeBlock(const char* source, size_t size);
+	void settle(int id, int value);
+	int flush(bool all);
+	
+public:
+	static const size_t READ_SIZE = 1 << 16;  // Bytes read at a time.
+	static const size_t FLUSH_WORDS = 4096;   // Settled words gathered before a write.
+	
+	StreamAssembler();
+	
+	int assemble(int input, FILE* output);
+	
+	string getError();
+	int getErrorLine();
+	size_t getWordCount();
+	size_t getMaxHeldWords();
+	size_t getMaxFixups();
+	const SymbolTable& getSymbols();
+};
+
+/**
+ * Keeps an assembled source, so an edit to a few lines is assembled without redoing the rest.
+ * Only the parsed form of each line is kept, not its text. An edit parses and encodes just its new lines.
+ * When it moves commands, or changes labels or the order variables are first used in, the label addresses 
+ * and variable registers are worked out again from the kept lines, and only the words of @symbol commands 
+ * whose symbol changed are patched. The words are always the same as assembling the whole source again.
+ */
+class IncrementalAssembler
+{
+private:
+	struct Line
+	{
+		static const unsigned char NONE = 0;     // Empty, a comment, or a label that is ignored.
+		static const unsigned char LABEL = 1;    // symbol is the label.
+		static const unsigned char SYMBOL = 2;   // An A command using symbol.
+		static const unsigned char FIXED = 3;    // An A command with a number or built-in symbol, or a C command; word is final.
+		static const unsigned char INVALID = 4;  // An invalid C command; symbol indexes invalidTexts.
+		
+		unsigned char kind;
+		uint16_t word;
+		int symbol;
+		int address; // Commands before this line.
+	};
+	
+	vector<Line> lines;
+	vector<uint16_t> words;
+	vector<int> references; // The symbol of each word's @symbol command, or -1.
+	
+	SymbolTable symbols;      // Every name seen. Value is the label address or variable register, or NOT_FOUND.
+	vector<int> useCounts;    // @symbol commands using each symbol.
+	vector<int> declarations; // Label declarations of each symbol.
+	int predefinedCount;
+	int deadCount;            // Symbols no line uses or declares any more, taken out by compact.
+	vector<string> invalidTexts;
+	vector<int> freeInvalids; // Indexes in invalidTexts no line holds any more, to be reused.
+	int invalidCount;
+	size_t encodedCount;
+	
+	void parse(const char* text, size_t size, vector<Line>* parsed);
+	int addSymbol(const char* name, int length);
+	void count(const Line& line, int delta);
+	void compact();
+	bool isVariable(int symbol);
+	void assignLabels(vector<int>* changed);
+	void assignVariables(vector<int>* changed);
+	
+public:
+	static const int COMPACT_MIN_DEAD = 1024; // Dead symbols kept before compact is worth it.
+	
+	IncrementalAssembler();
+	
+	void load(string_view source);
+	int edit(int firstLine, int lineCount, string_view text);
+	
+	bool isValid();
+	string getError();
+	int getErrorLine();
+	const vector<uint16_t>& getWords();
+	int getLineCount();
+	size_t getEncodedCount();
+};
+
+/**
+ * An asm source assembled on its own, to be linked with others later (.hobj).
+ * Numbers and built-in symbols are encoded in place. Every other @symbol command is left as 0 with a relocation
+ * naming the symbol, as whether it is a label or a variable, and its value, is only known once every module is there.
+ * The symbols are the labels the module declares, with their address in the module, and the ones it only uses.
+ *     offset 0   "HOBJ"
+ *     offset 4   uint16 version, 1
+ *     offset 6   uint16 header size, 24
+ *     offset 8   uint32 word count
+ *     offset 12  uint32 symbol count
+ *     offset 16  uint32 relocation count
+ *     offset 20  uint32 bytes of names
+ *     offset 24  the symbols: uint32 name offset, uint32 name length, int32 address or -1 if only used
+ *     then       the relocations: uint32 word, uint32 symbol, in word order
+ *     then       the words, uint16 each
+ *     then       the names, back to back
+ * Every number is little-endian.
+ */
+class ObjectModule
+{
+public:
+	struct Relocation
+	{
+		uint32_t word;   // Index of the word in the module.
+		uint32_t symbol; // Id of the symbol in getSymbols().
+	};
+	
+	static const size_t HEADER_SIZE = 24;
+	
+private:
+	vector<uint16_t> words;
+	SymbolTable symbols; // Value is the label's address in the module, or NOT_FOUND if it is only used.
+	vector<Relocation> relocations;
+	string error;
+	int errorLine;
+	
+public:
+	ObjectModule();
+	
+	int assemble(const char* source, size_t size);
+	string toObject() const;
+	int read(const char* data, size_t size);
+	
+	const vector<uint16_t>& getWords() const;
+	const SymbolTable& getSymbols() const;
+	const vector<Relocation>& getRelocations() const;
+	string getError();
+	int getErrorLine();
+};
+
+/**
+ * Joins ObjectModules into one program, the same as assembling their sources one after the other.
+ * Each module is placed after the ones before it. A label declared by several modules is the first one's,
+ * and a symbol no module declares is a variable, numbered from 16 in first use order as Resolver::addVar does.
+ * Only the symbol tables and relocations are read; the words are copied as they are.
+ */
+class Linker
+{
+private:
+	SymbolTable symbols; // Built-in symbols, labels and variables of the last link.
+	int varCount;
+	
+public:
+	Linker();
+	
+	void link(const vector<ObjectModule>& modules, vector<uint16_t>* words);
+	
+	const SymbolTable& getSymbols();
+	int getVarCount();
+};
+
+/**
+ * Removes instructions that cannot change what a program does, to save HACK CPU cycles; every instruction takes one.
+ * Works on the encoded words of an ObjectModule, after variables get their registers and before labels get their
+ * addresses, which are worked out again for what is left. Removes:
+ *     an A command followed by another A command, which overwrites it;
+ *     an A command loading the value A already holds, after C commands that do not write A;
+ *     a jump with no destination to the next instruction.
+ * Every label is taken to be a jump target, so A is not known after one. Jumps are taken to only go to labels:
+ * a program that jumps to a number, such as @5 0;JMP, may not run the same afterwards.
+ */
+class Optimizer
+{
+private:
+	size_t overwrittenCount;
+	size_t reloadCount;
+	size_t jumpCount;
+	vector<int> origins; // The module index of each word written.
+	
+public:
+	Optimizer();
+	
+	void optimize(const ObjectModule& module, vector<uint16_t>* words);
+	
+	size_t getRemovedCount();
+	size_t getOverwrittenCount();
+	size_t getReloadCount();
+	size_t getJumpCount();
+	const vector<int>& getOrigins();
+};
+
+/**
+ * Runs hack code on a HACK CPU in this process, counting how often each instruction runs.
+ * load decodes every word once into a Step: the comp bits become one of the 18 computations the assembler
+ * writes, or a general ALU step for any other bits, so run only switches on the op and never looks at bits again.
+ * Each instruction is one cycle. Memory is 32K words: RAM, then the screen at 16384 and the keyboard at 24576.
+ */
+class Executor
+{
+private:
+	struct Step
+	{
+		uint8_t op;   // One of the OP_ values in hackExecute.cpp.
+		uint8_t dest; // A 4, D 2, M 1.
+		uint8_t jump; // Less than zero 4, zero 2, more than zero 1.
+		uint8_t useM; // 1 if the comp reads M instead of A.
+		int16_t value; // What an A command loads, or the comp bits of a general ALU step.
+	};
+	
+	vector<Step> steps;
+	vector<int16_t> ram;
+	vector<unsigned long long> counts; // Runs of each instruction.
+	int16_t a;
+	int16_t d;
+	int pc;
+	unsigned long long cycles;
+	bool profiling;
+	
+	template <bool profile>
+	int execute(unsigned long long maxCycles);
+	
+public:
+	static const int STOP_BUDGET = 0; // Ran for the cycles it was given.
+	static const int STOP_HALT = 1;   // Reached a loop that does nothing but jump to itself, as programs end.
+	static const int STOP_END = 2;    // The program counter left the program.
+	
+	static const int RAM_SIZE = 32768;
+	static const int SCREEN = 16384;
+	static const int KEYBOARD = 24576;
+	
+	Executor();
+	
+	void load(const uint16_t* words, size_t count);
+	void reset();
+	int run(unsigned long long maxCycles);
+	
+	void setProfiling(bool on);
+	void setKeyboard(int16_t key);
+	int16_t peek(int address);
+	void poke(int address, int16_t value);
+	
+	unsigned long long getCycles();
+	int getPC();
+	int16_t getA();
+	int16_t getD();
+	const vector<unsigned long long>& getCounts();
+};
+
+/**
+ * Turns hack code back into asm code, the inverse of Interpreter.
+ * A table of all 65536 words, built once from Interpreter::encodeC itself, holds the asm text of every word,
+ * so each word is decoded by one lookup. Words the assembler never writes, such as C commands with comp bits
+ * outside its 28 computations, have no text and are reported.
+ * Large programs are cut into chunks; each is sized, then written in place, on its own thread.
+ * Labels can be given back from a symbol map: each is declared at its address, and an A command that loads one
+ * just before a jump names it. Variables stay numbers, as naming them could change the registers they get.
+ */
+class Disassembler
+{
+private:
+	struct Entry
+	{
+		char text[15];  // Such as "AMD=D|M;JMP" or "@32767".
+		uint8_t length; // 0 if no asm gives the word.
+	};
+	
+	vector<pair<int, string>> labels; // By address, then in the order they were given.
+	int threads;
+	string error;
+	
+	static const vector<Entry>& table();
+	const string* jumpLabel(const uint16_t* words, size_t count, size_t i);
+	
+public:
+	static const size_t CHUNK_WORDS = 1 << 18; // Words per chunk; smaller programs are one chunk.
+	
+	Disassembler();
+	
+	void setThreads(int threads);
+	void setLabels(const SymbolTable& symbols);
+	
+	int disassemble(const uint16_t* words, size_t count, string* output);
+	string getError();
+	
+	static string_view decode(uint16_t word);
+};
+
 #endif
\ No newline at end of file
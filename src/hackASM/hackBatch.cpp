@@ -0,0 +1,464 @@
+/************************************************************************-
+ *	hackBatch.cpp, the implementation of WorkPool and Batch from hackASM.h.
+ *  Assembles many files in one run of the program.
+ * 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+// WorkPool:
+/**
+ * @param threads The number of threads to run tasks on. Values below 1 use defaultThreadCount().
+ */
+WorkPool::WorkPool(int threads)
+{
+	threadCount = (threads < 1) ? defaultThreadCount() : threads;
+}
+
+/**
+ * @return The number of hardware threads, or 1 if it is unknown.
+ */
+int WorkPool::defaultThreadCount()
+{
+	int count = (int)std::thread::hardware_concurrency();
+	return (count < 1) ? 1 : count;
+}
+
+/**
+ * @return The number of threads tasks are run on.
+ */
+int WorkPool::getThreadCount()
+{
+	return threadCount;
+}
+
+/**
+ * Gets the threads each task may split itself over, so that taskCount tasks running at once use no more
+ * than the pool's threads.
+ *
+ * @param taskCount The number of tasks.
+ * @return The pool's threads shared out between the tasks, at least 1.
+ */
+int WorkPool::getThreadsPerTask(size_t taskCount)
+{
+	return (taskCount == 0) ? threadCount : (int)max((size_t)1, (size_t)threadCount / taskCount);
+}
+
+/**
+ * Takes a task from queue.
+ *
+ * @param queue The queue to take from.
+ * @param fromFront true for the owner of queue (largest task), false for a thief (smallest task).
+ * @param task Set to the task taken.
+ * @return false if queue was empty.
+ */
+bool WorkPool::take(Queue* queue, bool fromFront, size_t* task)
+{
+	lock_guard<mutex> guard(queue->lock);
+	if (queue->tasks.empty())
+		return false;
+	if (fromFront)
+	{
+		*task = queue->tasks.front();
+		queue->tasks.pop_front();
+	}
+	else
+	{
+		*task = queue->tasks.back();
+		queue->tasks.pop_back();
+	}
+	return true;
+}
+
+/**
+ * Runs work once for every task, and returns when all are done.
+ * work must be safe to call from several threads at once.
+ *
+ * @param costs The estimated cost of every task; the task numbers are the indexes.
+ * @param work Called with the task number and the number of the thread running it.
+ */
+void WorkPool::run(const vector<size_t>& costs, const function<void(size_t task, int thread)>& work)
+{
+	int threads = (int)min((size_t)threadCount, costs.size());
+	if (threads <= 1)
+	{
+		for (size_t i = 0; i < costs.size(); i++)
+			work(i, 0);
+		return;
+	}
+	
+	// Deal the tasks largest first, each to the queue with the least work so far.
+	vector<size_t> order(costs.size());
+	for (size_t i = 0; i < order.size(); i++)
+		order[i] = i;
+	stable_sort(order.begin(), order.end(), [&costs](size_t a, size_t b) { return costs[a] > costs[b]; });
+	
+	vector<Queue> queues(threads);
+	vector<size_t> loads(threads, 0);
+	for (size_t i = 0; i < order.size(); i++)
+	{
+		int least = (int)(min_element(loads.begin(), loads.end()) - loads.begin());
+		queues[least].tasks.push_back(order[i]);
+		loads[least] += costs[order[i]] + 1;
+	}
+	
+	vector<std::thread> pool;
+	for (int t = 0; t < threads; t++)
+	{
+		pool.push_back(std::thread([&queues, &work, threads, t]()
+		{
+			size_t task;
+			while (true)
+			{
+				bool found = take(&queues[t], true, &task);
+				for (int other = 1; !found && other < threads; other++) // Own queue is empty, steal.
+					found = take(&queues[(t + other) % threads], false, &task);
+				if (!found) // Tasks never get added, so every queue is empty for good.
+					return;
+				work(task, t);
+			}
+		}));
+	}
+	for (size_t t = 0; t < pool.size(); t++)
+		pool[t].join();
+	return;
+}
+
+
+// Batch:
+Batch::Batch()
+{
+	cache = NULL;
+	format = Formatter::FORMAT_HACK;
+	optimizeOn = false;
+	leanOn = false;
+	sourceMapOn = false;
+	listingOn = false;
+}
+
+/**
+ * @param format The output format of every file: Formatter::FORMAT_HACK, FORMAT_ROM or FORMAT_OBJECT.
+ */
+void Batch::setFormat(int format)
+{
+	this->format = format;
+	return;
+}
+
+/**
+ * @param on true to run every file through Optimizer.
+ */
+void Batch::setOptimize(bool on)
+{
+	optimizeOn = on;
+	return;
+}
+
+/**
+ * @param on true to assemble every file in lean mode; see Assembler::setLean.
+ */
+void Batch::setLean(bool on)
+{
+	leanOn = on;
+	return;
+}
+
+/**
+ * @param on true to write a .hmap source map next to every output; see Assembler::setSourceMap.
+ */
+void Batch::setSourceMap(bool on)
+{
+	sourceMapOn = on;
+	return;
+}
+
+/**
+ * @param on true to write a .lst listing next to every output; see Assembler::setListing.
+ */
+void Batch::setListing(bool on)
+{
+	listingOn = on;
+	return;
+}
+
+/**
+ * Makes every file look up its output in cache first.
+ *
+ * @param cache The cache, which must outlive run; NULL for none.
+ */
+void Batch::setCache(AssemblyCache* cache)
+{
+	this->cache = cache;
+	return;
+}
+
+/**
+ * Adds the files named by arg: an asm file, a directory searched for asm files, or @file listing one path per line.
+ *
+ * @param arg The command line argument.
+ * @return 0 on success, 1 if arg could not be read.
+ */
+int Batch::add(const string& arg)
+{
+	if (!arg.empty() && arg[0] == '@')
+		return addList(arg.substr(1));
+	
+	struct stat info;
+	if (stat(arg.c_str(), &info) != 0)
+	{
+		cout << "Path invalid: " << arg << "\n";
+		return 1;
+	}
+	if (S_ISDIR(info.st_mode))
+		return addDirectory(arg);
+	return addFile(arg, false);
+}
+
+/**
+ * Adds one file. A file already added is skipped, so no two threads write the same output.
+ *
+ * @param path The path of the file.
+ * @param mustBeAsm true to skip the file unless it ends in .asm, as when searching a directory.
+ * @return 0 on success, 1 if the file does not exist.
+ */
+int Batch::addFile(const string& path, bool mustBeAsm)
+{
+	if (mustBeAsm && (path.size() < 4 || path.compare(path.size() - 4, 4, ".asm") != 0))
+		return 0;
+	struct stat info;
+	if (stat(path.c_str(), &info) != 0)
+	{
+		cout << "Path invalid: " << path << "\n";
+		return 1;
+	}
+	if (!expand(path)) // Named twice, or both on its own and through its directory.
+		return 0;
+	paths.push_back(path);
+	sizes.push_back((size_t)info.st_size);
+	return 0;
+}
+
+/**
+ * Marks the file, directory or @file at path as added.
+ *
+ * @param path The path.
+ * @return false if it was added before, through any path, such as a list that names itself or a linked directory loop.
+ */
+bool Batch::expand(const string& path)
+{
+#ifdef _WIN32
+	char canonical[MAX_PATH];
+	string key = (GetFullPathNameA(path.c_str(), MAX_PATH, canonical, NULL) > 0) ? string(canonical) : path;
+#else
+	char* canonical = realpath(path.c_str(), NULL);
+	string key = (canonical != NULL) ? string(canonical) : path;
+	free(canonical);
+#endif
+	return expanded.insert(key).second;
+}
+
+/**
+ * Adds every .asm file in the directory at path and its sub directories.
+ * A directory already added is skipped.
+ *
+ * @param path The path of the directory.
+ * @return 0 on success, 1 if the directory could not be read.
+ */
+int Batch::addDirectory(const string& path)
+{
+	if (!expand(path))
+		return 0;
+	string prefix = path;
+	if (!prefix.empty() && prefix[prefix.size() - 1] != '/' && prefix[prefix.size() - 1] != '\\')
+		prefix.append(1, '/');
+	vector<string> directories;
+	
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((prefix + "*").c_str(), &entry);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		cout << "Path invalid: " << path << "\n";
+		return 1;
+	}
+	do
+	{
+		string name = entry.cFileName;
+		if (name == "." || name == "..")
+			continue;
+		if (entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+			directories.push_back(prefix + name);
+		else
+			addFile(prefix + name, true);
+	} while (FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR* dir = opendir(path.c_str());
+	if (dir == NULL)
+	{
+		cout << "Path invalid: " << path << "\n";
+		return 1;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		string name = entry->d_name;
+		if (name == "." || name == "..")
+			continue;
+		struct stat info;
+		if (stat((prefix + name).c_str(), &info) != 0)
+			continue;
+		if (S_ISDIR(info.st_mode))
+			directories.push_back(prefix + name);
+		else
+			addFile(prefix + name, true);
+	}
+	closedir(dir);
+#endif
+	
+	int error = 0;
+	for (size_t i = 0; i < directories.size(); i++)
+		error |= addDirectory(directories[i]);
+	return error;
+}
+
+/**
+ * Adds every path listed in the response file at path, one per line. Each line may itself be a directory or @file.
+ * A response file already added is skipped.
+ *
+ * @param path The path of the response file.
+ * @return 0 on success, 1 if it or any path in it could not be read.
+ */
+int Batch::addList(const string& path)
+{
+	if (!expand(path))
+		return 0;
+	ifstream list;
+	list.open(path, ios::in);
+	if (!list.is_open())
+	{
+		cout << "Path invalid: " << path << "\n";
+		return 1;
+	}
+	int error = 0;
+	string line;
+	while (std::getline(list, line))
+	{
+		while (!line.empty() && Resolver::isBlank(line[line.size() - 1]))
+			line.erase(line.size() - 1);
+		size_t start = 0;
+		while (start < line.size() && Resolver::isBlank(line[start]))
+			start++;
+		if (start < line.size())
+			error |= add(line.substr(start));
+	}
+	return error;
+}
+
+/**
+ * @return The path of every file added, in order.
+ */
+const vector<string>& Batch::getPaths()
+{
+	return paths;
+}
+
+/**
+ * @return The number of files added.
+ */
+size_t Batch::getFileCount()
+{
+	return paths.size();
+}
+
+/**
+ * Assembles every added file and prints a summary of the throughput and any errors.
+ *
+ * @param threads The number of threads to use, or 0 for one per hardware thread.
+ * @param printStats true to also print the stats of each file as a line of JSON.
+ * @return 0 if every file assembled, 1 otherwise.
+ */
+int Batch::run(int threads, bool printStats)
+{
+	WorkPool pool(threads);
+	vector<Assembler> assemblers(pool.getThreadCount()); // One per thread, reused for every file it runs.
+	for (size_t i = 0; i < assemblers.size(); i++)
+	{
+		assemblers[i].setThreads(pool.getThreadsPerTask(paths.size())); // Too few files to keep every thread busy; split the files too.
+		assemblers[i].setStats(printStats);
+		assemblers[i].setCache(cache);
+		assemblers[i].setFormat(format);
+		assemblers[i].setOptimize(optimizeOn);
+		assemblers[i].setLean(leanOn);
+		assemblers[i].setSourceMap(sourceMapOn);
+		assemblers[i].setListing(listingOn);
+	}
+	vector<string> errors(paths.size());
+	vector<size_t> wordCounts(paths.size(), 0);
+	vector<size_t> removedCounts(paths.size(), 0);
+	vector<AssemblyStats> stats(printStats ? paths.size() : 0);
+	
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	pool.run(sizes, [&](size_t task, int thread)
+	{
+		Assembler& assembler = assemblers[thread];
+		string path = paths[task];
+		if (assembler.assemble(&path[0]) == 1)
+			errors[task] = assembler.getError();
+		else
+		{
+			wordCounts[task] = assembler.getWordCount();
+			removedCounts[task] = assembler.getRemovedCount();
+		}
+		if (printStats)
+			stats[task] = assembler.getStats();
+	});
+	double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+	
+	size_t totalBytes = 0;
+	size_t totalWords = 0;
+	size_t totalRemoved = 0;
+	size_t failed = 0;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		if (!errors[i].empty())
+		{
+			cout << paths[i] << ": " << errors[i] << "\n";
+			failed++;
+			continue;
+		}
+		totalBytes += sizes[i];
+		totalWords += wordCounts[i];
+		totalRemoved += removedCounts[i];
+		if (printStats)
+			cout << stats[i].toJSON(paths[i]) << "\n";
+	}
+	if (seconds <= 0)
+		seconds = 1e-9;
+	
+	cout << "Assembled " << (paths.size() - failed) << " of " << paths.size() << " files on " 
+		<< pool.getThreadCount() << " threads in " << seconds << " s\n";
+	cout << "  " << totalBytes << " bytes, " << totalWords << " instructions: " 
+		<< (totalBytes / seconds / 1e6) << " MB/s, " << (totalWords / seconds) << " instructions/s\n";
+	if (optimizeOn)
+		cout << "  " << totalRemoved << " instructions removed, one cycle each every time they would have run\n";
+	if (failed > 0)
+	{
+		cout << "  " << failed << " files failed\n";
+		return 1;
+	}
+	return 0;
+}
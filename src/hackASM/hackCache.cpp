@@ -0,0 +1,325 @@
+/************************************************************************-
+ *	hackCache.cpp, the implementation of AssemblyCache from hackASM.h.
+ *  Kept apart from hackASM.cpp as the file handling is platform specific.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#include <sys/utime.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+static atomic<unsigned int> tempCounter(0); // Keeps the temporary files of one process apart.
+
+AssemblyCache::AssemblyCache()
+{
+	directory = "";
+	maxSize = DEFAULT_MAX_SIZE;
+	totalSize = 0;
+	counted = false;
+}
+
+/**
+ * Uses the directory at path as the cache, making it if needed.
+ *
+ * @param path The directory, or "" for defaultDirectory().
+ * @param maxSize The most bytes of entries to keep.
+ * @return 0 on success, 1 if the directory could not be made.
+ */
+int AssemblyCache::open(const string& path, unsigned long long maxSize)
+{
+	directory = path.empty() ? defaultDirectory() : path;
+	if (!directory.empty() && directory[directory.size() - 1] != '/' && directory[directory.size() - 1] != '\\')
+		directory.append(1, '/');
+	this->maxSize = maxSize;
+	totalSize = 0;
+	counted = false;
+	return makeDirectories(directory);
+}
+
+/**
+ * Writes the cached output for key to outputPath.
+ * If outputPath already holds the same bytes it is left alone, so its time stamp does not change.
+ *
+ * @param key The key of the source, from key().
+ * @param kind The kind of output, used as the entry's extension; "hack" for text.
+ * @param outputPath Where the output goes, or "-" for stdout.
+ * @param size Set to the size of the output on a hit.
+ * @return true on a hit, false if there is no entry or it could not be written.
+ */
+bool AssemblyCache::fetch(unsigned long long key, const string& kind, const string& outputPath, size_t* size)
+{
+	string path = entryPath(key, kind);
+	Source entry;
+	if (entry.open(path.c_str()) == 1)
+		return false;
+
+	bool same = false;
+	if (outputPath != "-")
+	{
+		struct stat info;
+		if (stat(outputPath.c_str(), &info) == 0 && (unsigned long long)info.st_size == entry.getSize())
+		{
+			Source existing;
+			same = (existing.open(outputPath.c_str()) == 0 && existing.getSize() == entry.getSize()
+				&& memcmp(existing.getData(), entry.getData(), entry.getSize()) == 0);
+		}
+	}
+	if (!same && Formatter::writeFile(outputPath, entry.getData(), entry.getSize()) == 1)
+		return false;
+
+	utime(path.c_str(), NULL); // Marks the entry as recently used, for evict.
+	*size = entry.getSize();
+	return true;
+}
+
+/**
+ * Adds the output for key. Writes a temporary file first and renames it into place,
+ * so other processes never see a partial entry. Errors are ignored; the entry is just missing.
+ *
+ * @param key The key of the source, from key().
+ * @param kind The kind of output, used as the entry's extension.
+ * @param data The output.
+ * @param size The number of bytes in data.
+ */
+void AssemblyCache::store(unsigned long long key, const string& kind, const char* data, size_t size)
+{
+	string path = entryPath(key, kind);
+#ifdef _WIN32
+	int pid = _getpid();
+#else
+	int pid = (int)getpid();
+#endif
+	string temp = path + "." + to_string(pid) + "." + to_string(tempCounter.fetch_add(1)) + ".tmp";
+	if (Formatter::writeFile(temp, data, size) == 1)
+	{
+		remove(temp.c_str());
+		return;
+	}
+#ifdef _WIN32
+	bool moved = MoveFileExA(temp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+	bool moved = rename(temp.c_str(), path.c_str()) == 0;
+#endif
+	if (!moved)
+	{
+		remove(temp.c_str());
+		return;
+	}
+
+	lock_guard<mutex> guard(lock);
+	totalSize += size;
+	if (!counted || totalSize > maxSize) // Count the entries once, then only when they may be too big.
+		evict();
+	return;
+}
+
+/**
+ * Counts the entries and, if they are over maxSize, removes the least recently used
+ * until they are under three quarters of it, so the next few stores do not have to count again.
+ * Temporary files are counted too, and removed once they are old enough to be left from a crash.
+ * Must be called with lock held.
+ */
+void AssemblyCache::evict()
+{
+	struct Entry
+	{
+		string path;
+		unsigned long long size;
+		time_t used;
+	};
+	vector<Entry> entries;
+
+#ifdef _WIN32
+	WIN32_FIND_DATAA found;
+	HANDLE find = FindFirstFileA((directory + "*").c_str(), &found);
+	if (find != INVALID_HANDLE_VALUE)
+	{
+		do
+		{
+			if (found.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+				continue;
+			struct stat info;
+			string path = directory + found.cFileName;
+			if (stat(path.c_str(), &info) == 0)
+				entries.push_back(Entry{path, (unsigned long long)info.st_size, info.st_mtime});
+		} while (FindNextFileA(find, &found));
+		FindClose(find);
+	}
+#else
+	DIR* dir = opendir(directory.c_str());
+	if (dir != NULL)
+	{
+		struct dirent* found;
+		while ((found = readdir(dir)) != NULL)
+		{
+			struct stat info;
+			string path = directory + found->d_name;
+			if (stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode))
+				entries.push_back(Entry{path, (unsigned long long)info.st_size, info.st_mtime});
+		}
+		closedir(dir);
+	}
+#endif
+
+	totalSize = 0;
+	for (size_t i = 0; i < entries.size(); i++)
+		totalSize += entries[i].size;
+	counted = true;
+	if (totalSize <= maxSize)
+		return;
+
+	sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+	{
+		return a.used < b.used;
+	});
+	time_t now = time(NULL);
+	unsigned long long target = maxSize / 4 * 3;
+	for (size_t i = 0; i < entries.size() && totalSize > target; i++)
+	{
+		const string& path = entries[i].path;
+		bool temporary = path.size() >= 4 && path.compare(path.size() - 4, 4, ".tmp") == 0;
+		if (temporary && now - entries[i].used < 600) // May still be being written.
+			continue;
+		if (remove(path.c_str()) == 0)
+			totalSize -= entries[i].size;
+	}
+	return;
+}
+
+/**
+ * @return The path of the entry for key.
+ */
+string AssemblyCache::entryPath(unsigned long long key, const string& kind)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.", key);
+	return directory + name + kind;
+}
+
+/**
+ * @return The directory of the cache, ending in a slash.
+ */
+const string& AssemblyCache::getDirectory()
+{
+	return directory;
+}
+
+/**
+ * Makes the directory at path and any parents that are missing.
+ *
+ * @param path The directory.
+ * @return 0 if the directory exists afterwards, 1 otherwise.
+ */
+int AssemblyCache::makeDirectories(const string& path)
+{
+	for (size_t i = 1; i <= path.size(); i++)
+	{
+		if (i < path.size() && path[i] != '/' && path[i] != '\\')
+			continue;
+		string parent = path.substr(0, i);
+#ifdef _WIN32
+		if (parent.size() == 2 && parent[1] == ':') // A drive.
+			continue;
+		_mkdir(parent.c_str());
+#else
+		mkdir(parent.c_str(), 0755);
+#endif
+	}
+	struct stat info;
+	return (stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFDIR)) ? 0 : 1;
+}
+
+/**
+ * Hashes data 8 bytes at a time, on two lanes so the multiplies overlap.
+ * Fast rather than secure; a cache key only has to tell sources apart.
+ *
+ * @param data The bytes to hash.
+ * @param size The number of bytes.
+ * @param seed Mixed in first, so different seeds give unrelated hashes.
+ * @return The 64 bit hash.
+ */
+unsigned long long AssemblyCache::hash(const char* data, size_t size, unsigned long long seed)
+{
+	const unsigned long long PRIME1 = 0x9E3779B185EBCA87ULL;
+	const unsigned long long PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+	unsigned long long lane1 = seed ^ PRIME1;
+	unsigned long long lane2 = (seed + size) ^ PRIME2;
+
+	size_t i = 0;
+	for (; i + 16 <= size; i += 16)
+	{
+		uint64_t a, b;
+		memcpy(&a, data + i, 8);
+		memcpy(&b, data + i + 8, 8);
+		lane1 = ((lane1 ^ a) * PRIME2);
+		lane1 = (lane1 << 31) | (lane1 >> 33);
+		lane2 = ((lane2 ^ b) * PRIME1);
+		lane2 = (lane2 << 29) | (lane2 >> 35);
+	}
+	unsigned char tail[16] = {0};
+	memcpy(tail, data + i, size - i);
+	uint64_t a, b;
+	memcpy(&a, tail, 8);
+	memcpy(&b, tail + 8, 8);
+	lane1 = (lane1 ^ a) * PRIME2;
+	lane2 = (lane2 ^ b) * PRIME1;
+
+	unsigned long long h = lane1 ^ ((lane2 << 27) | (lane2 >> 37)) ^ size;
+	h ^= h >> 33; // Final mix, so every input bit reaches every output bit.
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+/**
+ * @param source The asm code.
+ * @param size The number of chars in source.
+ * @return The cache key of source, which changes with Assembler::VERSION.
+ */
+unsigned long long AssemblyCache::key(const char* source, size_t size)
+{
+	static const unsigned long long VERSION_SEED = hash(Assembler::VERSION, strlen(Assembler::VERSION), 0);
+	return hash(source, size, VERSION_SEED);
+}
+
+/**
+ * @return The cache directory from HACK_CACHE_DIR, or else the user's cache directory.
+ */
+string AssemblyCache::defaultDirectory()
+{
+	const char* set = getenv("HACK_CACHE_DIR");
+	if (set != NULL && set[0] != '\0')
+		return set;
+#ifdef _WIN32
+	const char* base = getenv("LOCALAPPDATA");
+	if (base != NULL && base[0] != '\0')
+		return string(base) + "\\hackAssembler\\";
+	return ".hackcache\\";
+#else
+	const char* base = getenv("XDG_CACHE_HOME");
+	if (base != NULL && base[0] != '\0')
+		return string(base) + "/hackAssembler/";
+	base = getenv("HOME");
+	if (base != NULL && base[0] != '\0')
+		return string(base) + "/.cache/hackAssembler/";
+	return ".hackcache/";
+#endif
+}
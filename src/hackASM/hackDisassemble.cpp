@@ -0,0 +1,235 @@
+/************************************************************************-
+ *	hackDisassemble.cpp, the implementation of Disassembler from hackASM.h.
+ *  Turns hack code back into asm code, to inspect programs and check that they assemble back the same.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+#include <cstring>
+
+static const char* const DESTS[] = {"", "M", "D", "MD", "A", "AM", "AD", "AMD"};
+static const char* const COMPS[] = {
+	"0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1", "D+A", "D-A", "A-D", "D&A", "D|A",
+	"M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M", "D|M"};
+static const char* const JUMPS[] = {"", "JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP"};
+
+Disassembler::Disassembler()
+{
+	threads = 1;
+	error = "";
+}
+
+/**
+ * Builds the text of every word once. C commands are encoded from every dest, comp and jump
+ * with Interpreter::encodeC, so the table is exactly its inverse.
+ *
+ * @return The entry of each word.
+ */
+const vector<Disassembler::Entry>& Disassembler::table()
+{
+	static const vector<Entry> entries = []()
+	{
+		vector<Entry> built(65536);
+		for (int word = 0; word < 0x8000; word++)
+		{
+			string text = "@" + to_string(word);
+			memcpy(built[word].text, text.data(), text.size());
+			built[word].length = (uint8_t)text.size();
+		}
+		for (int d = 0; d < 8; d++)
+		{
+			for (size_t c = 0; c < sizeof(COMPS) / sizeof(COMPS[0]); c++)
+			{
+				for (int j = 0; j < 8; j++)
+				{
+					string text = string(DESTS[d]) + (d > 0 ? "=" : "") + COMPS[c] + (j > 0 ? ";" : "") + JUMPS[j];
+					int word = Interpreter::encodeC(text.data(), (int)text.size());
+					memcpy(built[word].text, text.data(), text.size());
+					built[word].length = (uint8_t)text.size();
+				}
+			}
+		}
+		return built;
+	}();
+	return entries;
+}
+
+/**
+ * @param word A word of hack code.
+ * @return Its asm text, or an empty string if the assembler never writes it.
+ */
+string_view Disassembler::decode(uint16_t word)
+{
+	const Entry& entry = table()[word];
+	return string_view(entry.text, entry.length);
+}
+
+/**
+ * Sets the number of threads a large program is disassembled on. The default is 1; 0 is one per hardware thread.
+ *
+ * @param threads The number of threads.
+ */
+void Disassembler::setThreads(int threads)
+{
+	this->threads = threads;
+	return;
+}
+
+/**
+ * Sets the labels to give back to the following programs, such as the symbols of an ObjectModule.
+ *
+ * @param symbols Every symbol with a value is taken as a label at that ROM address; the others are left out.
+ */
+void Disassembler::setLabels(const SymbolTable& symbols)
+{
+	labels.clear();
+	for (int id = 0; id < symbols.size(); id++)
+	{
+		if (symbols.getValue(id) != SymbolTable::NOT_FOUND)
+			labels.push_back(make_pair(symbols.getValue(id), string(symbols.getName(id))));
+	}
+	stable_sort(labels.begin(), labels.end(), [](const pair<int, string>& x, const pair<int, string>& y) { return x.first < y.first; });
+	return;
+}
+
+/**
+ * Gets the label an A command names, if it loads a label's address just before a jump.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @param i The index of the A command.
+ * @return The first label at the address it loads, or NULL.
+ */
+const string* Disassembler::jumpLabel(const uint16_t* words, size_t count, size_t i)
+{
+	if (labels.empty() || i + 1 >= count || (words[i + 1] & 0xE007) <= 0xE000) // Not a C command that jumps.
+		return NULL;
+	int address = words[i];
+	vector<pair<int, string>>::const_iterator found = lower_bound(labels.begin(), labels.end(), address,
+		[](const pair<int, string>& label, int value) { return label.first < value; });
+	if (found == labels.end() || found->first != address || (size_t)address > count) // Only labels that get declared.
+		return NULL;
+	return &found->second;
+}
+
+/**
+ * Disassembles words into asm code, one command per line, with the labels given by setLabels declared
+ * on lines of their own. Assembling the output gives words back.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ * @param output Set to the asm code.
+ * @return 0 on success, 1 if a word is not one the assembler writes; see getError().
+ */
+int Disassembler::disassemble(const uint16_t* words, size_t count, string* output)
+{
+	const Entry* entries = table().data();
+	error = "";
+	output->clear();
+	size_t chunkCount = max((count + CHUNK_WORDS - 1) / CHUNK_WORDS, (size_t)1);
+
+	// The labels of each chunk: those at its addresses, and for the last, those at the end of the program.
+	vector<size_t> firstLabels(chunkCount + 1);
+	for (size_t c = 0; c <= chunkCount; c++)
+	{
+		int address = (c == chunkCount) ? (int)count + 1 : (int)(c * CHUNK_WORDS);
+		firstLabels[c] = lower_bound(labels.begin(), labels.end(), address,
+			[](const pair<int, string>& label, int value) { return label.first < value; }) - labels.begin();
+	}
+	vector<size_t> costs(chunkCount);
+	for (size_t c = 0; c < chunkCount; c++)
+		costs[c] = min(count - min(count, c * CHUNK_WORDS), (size_t)CHUNK_WORDS);
+	WorkPool pool((chunkCount == 1) ? 1 : threads);
+
+	// Size every chunk, so each can be written in place.
+	vector<size_t> sizes(chunkCount, 0);
+	vector<size_t> invalid(chunkCount, count); // First word with no text in each chunk.
+	pool.run(costs, [&](size_t c, int)
+	{
+		size_t begin = c * CHUNK_WORDS;
+		size_t end = begin + costs[c];
+		size_t bytes = 0;
+		for (size_t l = firstLabels[c]; l < firstLabels[c + 1]; l++)
+			bytes += labels[l].second.size() + 3; // "(NAME)\n"
+		for (size_t i = begin; i < end; i++)
+		{
+			const Entry& entry = entries[words[i]];
+			if (entry.length == 0)
+			{
+				invalid[c] = i;
+				break;
+			}
+			const string* name = (words[i] & 0x8000) ? NULL : jumpLabel(words, count, i);
+			bytes += (name != NULL) ? name->size() + 2 : entry.length + 1;
+		}
+		sizes[c] = bytes;
+	});
+	for (size_t c = 0; c < chunkCount; c++)
+	{
+		if (invalid[c] < count)
+		{
+			size_t i = invalid[c];
+			string bits = Formatter::toHack(vector<uint16_t>(1, words[i]));
+			error = "Word " + to_string(i) + ": " + bits + " is not an instruction the assembler writes";
+			return 1;
+		}
+	}
+
+	vector<size_t> offsets(chunkCount + 1, 0);
+	for (size_t c = 0; c < chunkCount; c++)
+		offsets[c + 1] = offsets[c] + sizes[c];
+	output->resize(offsets[chunkCount]);
+	char* text = &(*output)[0];
+	pool.run(costs, [&](size_t c, int)
+	{
+		size_t begin = c * CHUNK_WORDS;
+		size_t end = begin + costs[c];
+		char* out = text + offsets[c];
+		char* limit = text + offsets[c + 1]; // Each chunk only writes its own bytes.
+		size_t l = firstLabels[c];
+		auto declare = [&](size_t upTo)
+		{
+			for (; l < firstLabels[c + 1] && (size_t)labels[l].first <= upTo; l++)
+			{
+				*out++ = '(';
+				memcpy(out, labels[l].second.data(), labels[l].second.size());
+				out += labels[l].second.size();
+				*out++ = ')';
+				*out++ = '\n';
+			}
+		};
+		for (size_t i = begin; i < end; i++)
+		{
+			declare(i);
+			const string* name = (words[i] & 0x8000) ? NULL : jumpLabel(words, count, i);
+			if (name != NULL)
+			{
+				*out++ = '@';
+				memcpy(out, name->data(), name->size());
+				out += name->size();
+			}
+			else
+			{
+				const Entry& entry = entries[words[i]];
+				if ((size_t)(limit - out) >= sizeof(Entry))
+					memcpy(out, &entry, sizeof(Entry)); // A fixed size copy; the bytes past the text are written over next.
+				else
+					memcpy(out, entry.text, entry.length);
+				out += entry.length;
+			}
+			*out++ = '\n';
+		}
+		declare(count); // Labels at the end of the program, in the last chunk.
+	});
+	return 0;
+}
+
+/**
+ * @return The reason disassemble failed, or an empty string.
+ */
+string Disassembler::getError()
+{
+	return error;
+}
@@ -0,0 +1,296 @@
+/************************************************************************-
+ *	hackExecute.cpp, the implementation of Executor from hackASM.h.
+ *  Runs hack code on a HACK CPU in this process, so programs can be timed in cycles without a simulator.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+
+// Ops of a decoded Step. X is A or M, as the step's useM says.
+enum
+{
+	OP_LOAD, // An A command.
+	OP_ZERO, OP_ONE, OP_MINUS_ONE, OP_D, OP_X, OP_NOT_D, OP_NOT_X, OP_NEG_D, OP_NEG_X,
+	OP_D_PLUS_ONE, OP_X_PLUS_ONE, OP_D_MINUS_ONE, OP_X_MINUS_ONE,
+	OP_D_PLUS_X, OP_D_MINUS_X, OP_X_MINUS_D, OP_D_AND_X, OP_D_OR_X,
+	OP_ALU // Any other comp bits, worked out as the ALU would.
+};
+
+/**
+ * @param comp The 6 comp bits of a C command, zx nx zy ny f no.
+ * @return The op for comp.
+ */
+static uint8_t decodeComp(int comp)
+{
+	switch (comp)
+	{
+		case 0x2A: return OP_ZERO;
+		case 0x3F: return OP_ONE;
+		case 0x3A: return OP_MINUS_ONE;
+		case 0x0C: return OP_D;
+		case 0x30: return OP_X;
+		case 0x0D: return OP_NOT_D;
+		case 0x31: return OP_NOT_X;
+		case 0x0F: return OP_NEG_D;
+		case 0x33: return OP_NEG_X;
+		case 0x1F: return OP_D_PLUS_ONE;
+		case 0x37: return OP_X_PLUS_ONE;
+		case 0x0E: return OP_D_MINUS_ONE;
+		case 0x32: return OP_X_MINUS_ONE;
+		case 0x02: return OP_D_PLUS_X;
+		case 0x13: return OP_D_MINUS_X;
+		case 0x07: return OP_X_MINUS_D;
+		case 0x00: return OP_D_AND_X;
+		case 0x15: return OP_D_OR_X;
+		default: return OP_ALU;
+	}
+}
+
+/**
+ * Works out the ALU's output for any comp bits, for the comps the assembler never writes.
+ */
+static int16_t alu(int comp, int16_t d, int16_t x)
+{
+	uint16_t left = (uint16_t)d;
+	uint16_t right = (uint16_t)x;
+	if (comp & 0x20)
+		left = 0;
+	if (comp & 0x10)
+		left = (uint16_t)~left;
+	if (comp & 0x08)
+		right = 0;
+	if (comp & 0x04)
+		right = (uint16_t)~right;
+	uint16_t out = (comp & 0x02) ? (uint16_t)(left + right) : (uint16_t)(left & right);
+	if (comp & 0x01)
+		out = (uint16_t)~out;
+	return (int16_t)out;
+}
+
+Executor::Executor()
+{
+	ram.assign(RAM_SIZE, 0);
+	a = 0;
+	d = 0;
+	pc = 0;
+	cycles = 0;
+	profiling = false;
+}
+
+/**
+ * Decodes words as the program to run, and resets the CPU.
+ *
+ * @param words The hack code.
+ * @param count The number of words.
+ */
+void Executor::load(const uint16_t* words, size_t count)
+{
+	steps.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		Step& step = steps[i];
+		uint16_t word = words[i];
+		if ((word & 0x8000) == 0)
+		{
+			step = Step{OP_LOAD, 0, 0, 0, (int16_t)word};
+			continue;
+		}
+		int comp = (word >> 6) & 0x3F;
+		step.op = decodeComp(comp);
+		step.dest = (uint8_t)((word >> 3) & 7);
+		step.jump = (uint8_t)(word & 7);
+		step.useM = (uint8_t)((word >> 12) & 1);
+		step.value = (int16_t)comp;
+	}
+	reset();
+	return;
+}
+
+/**
+ * Clears the registers, memory and counts, and starts the program again from address 0.
+ */
+void Executor::reset()
+{
+	fill(ram.begin(), ram.end(), 0);
+	counts.assign(steps.size(), 0);
+	a = 0;
+	d = 0;
+	pc = 0;
+	cycles = 0;
+	return;
+}
+
+/**
+ * Runs the program from where it stopped.
+ *
+ * @param maxCycles The most cycles to run for.
+ * @return STOP_BUDGET, STOP_HALT or STOP_END.
+ */
+int Executor::run(unsigned long long maxCycles)
+{
+	return profiling ? execute<true>(maxCycles) : execute<false>(maxCycles);
+}
+
+/**
+ * The CPU loop, with counting compiled in only when profiling.
+ */
+template <bool profile>
+int Executor::execute(unsigned long long maxCycles)
+{
+	const Step* program = steps.data();
+	int size = (int)steps.size();
+	int16_t* memory = ram.data();
+	unsigned long long* runs = counts.data();
+	int16_t regA = a;
+	int16_t regD = d;
+	int at = pc;
+	unsigned long long done = 0;
+	int stop = STOP_BUDGET;
+
+	while (done < maxCycles)
+	{
+		if (at < 0 || at >= size)
+		{
+			stop = STOP_END;
+			break;
+		}
+		const Step& step = program[at];
+		if (profile)
+			runs[at]++;
+		done++;
+		if (step.op == OP_LOAD)
+		{
+			regA = step.value;
+			at++;
+			continue;
+		}
+
+		int address = (uint16_t)regA & 0x7FFF; // M and the jump use A from before this step.
+		int16_t x = step.useM ? memory[address] : regA;
+		int16_t out;
+		switch (step.op)
+		{
+			case OP_ZERO: out = 0; break;
+			case OP_ONE: out = 1; break;
+			case OP_MINUS_ONE: out = -1; break;
+			case OP_D: out = regD; break;
+			case OP_X: out = x; break;
+			case OP_NOT_D: out = (int16_t)~regD; break;
+			case OP_NOT_X: out = (int16_t)~x; break;
+			case OP_NEG_D: out = (int16_t)(0 - (uint16_t)regD); break;
+			case OP_NEG_X: out = (int16_t)(0 - (uint16_t)x); break;
+			case OP_D_PLUS_ONE: out = (int16_t)((uint16_t)regD + 1); break;
+			case OP_X_PLUS_ONE: out = (int16_t)((uint16_t)x + 1); break;
+			case OP_D_MINUS_ONE: out = (int16_t)((uint16_t)regD - 1); break;
+			case OP_X_MINUS_ONE: out = (int16_t)((uint16_t)x - 1); break;
+			case OP_D_PLUS_X: out = (int16_t)((uint16_t)regD + (uint16_t)x); break;
+			case OP_D_MINUS_X: out = (int16_t)((uint16_t)regD - (uint16_t)x); break;
+			case OP_X_MINUS_D: out = (int16_t)((uint16_t)x - (uint16_t)regD); break;
+			case OP_D_AND_X: out = (int16_t)(regD & x); break;
+			case OP_D_OR_X: out = (int16_t)(regD | x); break;
+			default: out = alu(step.value, regD, x); break;
+		}
+		if (step.dest & 1)
+			memory[address] = out;
+		if (step.dest & 2)
+			regD = out;
+		if (step.dest & 4)
+			regA = out;
+
+		int sign = (out < 0) ? 4 : ((out == 0) ? 2 : 1);
+		if ((step.jump & sign) == 0)
+		{
+			at++;
+			continue;
+		}
+		// A jump that changes nothing to itself, or to the @ command just before it, loops for ever.
+		if (step.dest == 0 && (address == at || (address == at - 1 && program[address].op == OP_LOAD && program[address].value == address)))
+		{
+			at = address;
+			stop = STOP_HALT;
+			break;
+		}
+		at = address;
+	}
+
+	a = regA;
+	d = regD;
+	pc = at;
+	cycles += done;
+	return stop;
+}
+
+/**
+ * Turns the run counts of each instruction on or off. They are off by default, and cost nothing then.
+ *
+ * @param on true to count.
+ */
+void Executor::setProfiling(bool on)
+{
+	profiling = on;
+	return;
+}
+
+/**
+ * @param key The key code the program reads at KEYBOARD, or 0 for none.
+ */
+void Executor::setKeyboard(int16_t key)
+{
+	ram[KEYBOARD] = key;
+	return;
+}
+
+/**
+ * @param address A memory address, below RAM_SIZE.
+ * @return The word at address.
+ */
+int16_t Executor::peek(int address)
+{
+	return ram[address & 0x7FFF];
+}
+
+/**
+ * @param address A memory address, below RAM_SIZE.
+ * @param value The word to put there, such as an argument before running.
+ */
+void Executor::poke(int address, int16_t value)
+{
+	ram[address & 0x7FFF] = value;
+	return;
+}
+
+/**
+ * @return The cycles run since the last reset.
+ */
+unsigned long long Executor::getCycles()
+{
+	return cycles;
+}
+
+/**
+ * @return The address of the next instruction to run.
+ */
+int Executor::getPC()
+{
+	return pc;
+}
+
+int16_t Executor::getA()
+{
+	return a;
+}
+
+int16_t Executor::getD()
+{
+	return d;
+}
+
+/**
+ * @return How many times each instruction has run since the last reset, if profiling.
+ */
+const vector<unsigned long long>& Executor::getCounts()
+{
+	return counts;
+}
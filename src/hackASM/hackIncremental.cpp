@@ -0,0 +1,508 @@
+/************************************************************************-
+ *	hackIncremental.cpp, the implementation of IncrementalAssembler from hackASM.h.
+ *  Re-assembles an edited source by redoing only what the edit changed.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+
+/**
+ * Replaces count elements of v at position with added. Elements are overwritten where they can be,
+ * so an edit that keeps the number of lines or commands moves nothing.
+ */
+template <typename T>
+static void splice(vector<T>* v, size_t position, size_t count, const vector<T>& added)
+{
+	size_t same = min(count, added.size());
+	copy(added.begin(), added.begin() + same, v->begin() + position);
+	if (count > same)
+		v->erase(v->begin() + position + same, v->begin() + position + count);
+	else
+		v->insert(v->begin() + position + same, added.begin() + same, added.end());
+	return;
+}
+
+IncrementalAssembler::IncrementalAssembler()
+{
+	predefinedCount = 0;
+	deadCount = 0;
+	invalidCount = 0;
+	encodedCount = 0;
+	load("");
+}
+
+/**
+ * Assembles the whole of source, replacing anything loaded before.
+ *
+ * @param source The asm code. Only read, not kept.
+ */
+void IncrementalAssembler::load(string_view source)
+{
+	symbols = SymbolTable::predefined();
+	predefinedCount = symbols.size();
+	useCounts.assign(predefinedCount, 0);
+	declarations.assign(predefinedCount, 0);
+	deadCount = 0;
+	invalidTexts.clear();
+	freeInvalids.clear();
+	invalidCount = 0;
+
+	parse(source.data(), source.size(), &lines);
+	words.clear();
+	references.clear();
+	int address = 0;
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		Line& line = lines[i];
+		line.address = address;
+		count(line, 1);
+		if (line.kind != Line::NONE && line.kind != Line::LABEL)
+		{
+			words.push_back(line.word);
+			references.push_back(line.kind == Line::SYMBOL ? line.symbol : -1);
+			address++;
+		}
+	}
+
+	vector<int> changed;
+	assignLabels(&changed);
+	assignVariables(&changed);
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		if (references[i] >= 0)
+			words[i] = (uint16_t)(symbols.getValue(references[i]) & 0x7FFF);
+	}
+	encodedCount = words.size();
+	return;
+}
+
+/**
+ * Replaces lines of the source with text, and assembles the change.
+ * Lines are numbered from 1, as in the source; a source of n new line chars has n + 1 lines,
+ * so deleting every line leaves one empty line, as assembling an empty source would.
+ *
+ * @param firstLine The first line to replace. getLineCount() + 1 appends after the last line.
+ * @param lineCount The number of lines to replace; 0 to insert before firstLine.
+ * @param text The new lines, each ending in a new line char; the last may leave it out. Empty to delete the lines.
+ * @return 0 on success, 1 if the lines are not in the source. The new source may still be invalid; see isValid.
+ */
+int IncrementalAssembler::edit(int firstLine, int lineCount, string_view text)
+{
+	if (firstLine < 1 || lineCount < 0 || (size_t)(firstLine - 1) + lineCount > lines.size())
+		return 1;
+	size_t first = (size_t)firstLine - 1;
+	size_t last = first + lineCount;
+
+	vector<Line> added;
+	if (!text.empty())
+	{
+		parse(text.data(), text.size(), &added);
+		if (text[text.size() - 1] == '\n') // The empty line after the last new line is not one of the new lines.
+			added.pop_back();
+	}
+
+	// What the old and new lines hold; only these can change a label address or the variable order.
+	vector<pair<int, int>> oldLabels, newLabels; // Symbol and the commands before it in the range.
+	vector<int> oldUses, newUses;
+	int oldCommands = 0;
+	int newCommands = 0;
+	for (size_t i = first; i < last; i++)
+	{
+		const Line& line = lines[i];
+		if (line.kind == Line::LABEL)
+			oldLabels.push_back(make_pair(line.symbol, oldCommands));
+		else if (line.kind != Line::NONE)
+		{
+			if (line.kind == Line::SYMBOL)
+				oldUses.push_back(line.symbol);
+			oldCommands++;
+		}
+	}
+	for (size_t i = 0; i < added.size(); i++)
+	{
+		const Line& line = added[i];
+		if (line.kind == Line::LABEL)
+			newLabels.push_back(make_pair(line.symbol, newCommands));
+		else if (line.kind != Line::NONE)
+		{
+			if (line.kind == Line::SYMBOL)
+				newUses.push_back(line.symbol);
+			newCommands++;
+		}
+	}
+
+	// A symbol that gains its first, or loses its last, declaration turns between label and variable.
+	vector<bool> wasLabel(oldLabels.size() + newLabels.size());
+	for (size_t i = 0; i < oldLabels.size(); i++)
+		wasLabel[i] = declarations[oldLabels[i].first] > 0;
+	for (size_t i = 0; i < newLabels.size(); i++)
+		wasLabel[oldLabels.size() + i] = declarations[newLabels[i].first] > 0;
+	for (size_t i = first; i < last; i++)
+		count(lines[i], -1);
+	for (size_t i = 0; i < added.size(); i++)
+		count(added[i], 1);
+	bool kindChanged = false;
+	for (size_t i = 0; i < oldLabels.size(); i++)
+		kindChanged |= (declarations[oldLabels[i].first] > 0) != wasLabel[i];
+	for (size_t i = 0; i < newLabels.size(); i++)
+		kindChanged |= (declarations[newLabels[i].first] > 0) != wasLabel[oldLabels.size() + i];
+	bool variableUsesChanged = false;
+	if (oldUses != newUses)
+	{
+		for (size_t i = 0; i < oldUses.size() && !variableUsesChanged; i++)
+			variableUsesChanged = isVariable(oldUses[i]);
+		for (size_t i = 0; i < newUses.size() && !variableUsesChanged; i++)
+			variableUsesChanged = isVariable(newUses[i]);
+	}
+
+	// Splice in the new lines and their words.
+	int romStart = (first < lines.size()) ? lines[first].address : (int)words.size();
+	int delta = newCommands - oldCommands;
+	vector<uint16_t> addedWords;
+	vector<int> addedReferences;
+	int address = romStart;
+	for (size_t i = 0; i < added.size(); i++)
+	{
+		added[i].address = address;
+		if (added[i].kind != Line::NONE && added[i].kind != Line::LABEL)
+		{
+			addedWords.push_back(added[i].word);
+			addedReferences.push_back(added[i].kind == Line::SYMBOL ? added[i].symbol : -1);
+			address++;
+		}
+	}
+	splice(&lines, first, last - first, added);
+	if (delta != 0)
+	{
+		for (size_t i = first + added.size(); i < lines.size(); i++)
+			lines[i].address += delta;
+	}
+	if (lines.empty()) // An empty source is still one line.
+		lines.push_back(Line{Line::NONE, 0, -1, 0});
+	splice(&words, romStart, oldCommands, addedWords);
+	splice(&references, romStart, oldCommands, addedReferences);
+
+	// Work out the symbols again only if the edit can have changed them, then patch their uses.
+	vector<int> changed;
+	if (delta != 0 || oldLabels != newLabels)
+		assignLabels(&changed);
+	if (kindChanged || variableUsesChanged)
+		assignVariables(&changed);
+	encodedCount = newCommands;
+	if (!changed.empty())
+	{
+		vector<char> marked(symbols.size(), 0);
+		for (size_t i = 0; i < changed.size(); i++)
+			marked[changed[i]] = 1;
+		for (size_t i = 0; i < words.size(); i++)
+		{
+			if (references[i] >= 0 && marked[references[i]])
+			{
+				words[i] = (uint16_t)(symbols.getValue(references[i]) & 0x7FFF);
+				encodedCount++;
+			}
+		}
+	}
+	for (int i = 0; i < newCommands; i++)
+	{
+		if (references[romStart + i] >= 0)
+			words[romStart + i] = (uint16_t)(symbols.getValue(references[romStart + i]) & 0x7FFF);
+	}
+	
+	// Names edited away are only dropped once they are most of the table, so each costs a constant on average.
+	if (deadCount > COMPACT_MIN_DEAD && deadCount > symbols.size() - predefinedCount - deadCount)
+		compact();
+	return 0;
+}
+
+/**
+ * Parses text into one Line per line, adding any new names to this->symbols.
+ * The lines' addresses are not set.
+ *
+ * @param text The asm code.
+ * @param size The number of chars in text.
+ * @param parsed Set to the lines.
+ */
+void IncrementalAssembler::parse(const char* text, size_t size, vector<Line>* parsed)
+{
+	vector<Instruction> commands;
+	vector<Label> labels;
+	int newLines = Resolver::scan(text, 0, size, &commands, &labels);
+	parsed->assign((size_t)newLines + 1, Line{Line::NONE, 0, -1, 0});
+
+	string scratch;
+	int length;
+	for (size_t n = 0; n < commands.size(); n++)
+	{
+		const Instruction& command = commands[n];
+		Line& line = (*parsed)[command.line - 1];
+		if (command.kind == Instruction::A_COMMAND)
+		{
+			const char* name = Resolver::compact(text + command.start + 1, command.length - 1, &scratch, &length);
+			line.kind = Line::FIXED;
+			if (Resolver::isNumber(name, length))
+			{
+				line.word = (uint16_t)Resolver::parseNumber(name, length);
+				continue;
+			}
+			int id = addSymbol(name, length);
+			if (id < predefinedCount)
+				line.word = (uint16_t)(symbols.getValue(id) & 0x7FFF);
+			else
+			{
+				line.kind = Line::SYMBOL;
+				line.symbol = id;
+			}
+		}
+		else
+		{
+			const char* code = Resolver::compact(text + command.start, command.length, &scratch, &length);
+			int word = Interpreter::encodeC(code, length);
+			if (word == Interpreter::CODE_ERROR)
+			{
+				line.kind = Line::INVALID;
+				if (freeInvalids.empty())
+				{
+					line.symbol = (int)invalidTexts.size();
+					invalidTexts.push_back("");
+				}
+				else
+				{
+					line.symbol = freeInvalids.back();
+					freeInvalids.pop_back();
+				}
+				invalidTexts[line.symbol] = "Invalid command: " + string(code, length);
+			}
+			else
+			{
+				line.kind = Line::FIXED;
+				line.word = (uint16_t)word;
+			}
+		}
+	}
+
+	size_t position = 0; // Labels come in order, so their lines are counted from the last one.
+	int lineNumber = 0;
+	for (size_t i = 0; i < labels.size(); i++)
+	{
+		for (; position < labels[i].start; position++)
+		{
+			if (text[position] == '\n')
+				lineNumber++;
+		}
+		const char* name = Resolver::compact(text + labels[i].start, labels[i].length, &scratch, &length);
+		if (Resolver::isNumber(name, length)) // Ignored, as by Resolver.
+			continue;
+		int id = addSymbol(name, length);
+		if (id < predefinedCount) // A built-in symbol can not be declared again.
+			continue;
+		(*parsed)[lineNumber].kind = Line::LABEL;
+		(*parsed)[lineNumber].symbol = id;
+	}
+	return;
+}
+
+/**
+ * Finds a name in this->symbols, adding it if it is new. A new symbol counts as dead until a line is counted for it.
+ *
+ * @return The id of the symbol.
+ */
+int IncrementalAssembler::addSymbol(const char* name, int length)
+{
+	int id = symbols.find(name, length);
+	if (id == SymbolTable::NOT_FOUND)
+	{
+		id = symbols.add(name, length, SymbolTable::NOT_FOUND);
+		useCounts.push_back(0);
+		declarations.push_back(0);
+		deadCount++;
+	}
+	return id;
+}
+
+/**
+ * Counts line in or out of the source: the uses and declarations of its symbol, and its invalid command.
+ * An invalid command's text is freed for reuse when its line is counted out.
+ *
+ * @param line A parsed line.
+ * @param delta 1 when the line is added, -1 when it is taken out.
+ */
+void IncrementalAssembler::count(const Line& line, int delta)
+{
+	if (line.kind == Line::INVALID)
+	{
+		invalidCount += delta;
+		if (delta < 0)
+		{
+			string().swap(invalidTexts[line.symbol]);
+			freeInvalids.push_back(line.symbol);
+		}
+		return;
+	}
+	if (line.kind != Line::LABEL && line.kind != Line::SYMBOL)
+		return;
+	bool wasDead = (useCounts[line.symbol] == 0 && declarations[line.symbol] == 0);
+	if (line.kind == Line::LABEL)
+		declarations[line.symbol] += delta;
+	else
+		useCounts[line.symbol] += delta;
+	bool isDead = (useCounts[line.symbol] == 0 && declarations[line.symbol] == 0);
+	deadCount += (int)isDead - (int)wasDead;
+	return;
+}
+
+/**
+ * Builds this->symbols again with only the symbols a line still uses or declares, keeping their values,
+ * and renumbers the lines and references to the new ids.
+ */
+void IncrementalAssembler::compact()
+{
+	SymbolTable live = SymbolTable::predefined();
+	vector<int> ids(symbols.size(), -1);
+	useCounts.resize(symbols.size());
+	declarations.resize(symbols.size());
+	int kept = 0;
+	for (int id = 0; id < symbols.size(); id++)
+	{
+		if (id >= predefinedCount && useCounts[id] == 0 && declarations[id] == 0)
+			continue;
+		if (id >= predefinedCount)
+		{
+			string_view name = symbols.getName(id);
+			live.add(name.data(), (int)name.size(), symbols.getValue(id));
+		}
+		useCounts[kept] = useCounts[id];
+		declarations[kept] = declarations[id];
+		ids[id] = kept++;
+	}
+	useCounts.resize(kept);
+	declarations.resize(kept);
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		if (lines[i].kind == Line::LABEL || lines[i].kind == Line::SYMBOL)
+			lines[i].symbol = ids[lines[i].symbol];
+	}
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		if (references[i] >= 0)
+			references[i] = ids[references[i]];
+	}
+	symbols = live;
+	deadCount = 0;
+	return;
+}
+
+/**
+ * @param symbol The id of a symbol that is not built-in.
+ * @return true if the symbol is a variable: it is never declared as a label.
+ */
+bool IncrementalAssembler::isVariable(int symbol)
+{
+	return declarations[symbol] == 0;
+}
+
+/**
+ * Gives every label the address of its first declaration.
+ *
+ * @param changed The labels whose address changed are added.
+ */
+void IncrementalAssembler::assignLabels(vector<int>* changed)
+{
+	vector<char> seen(symbols.size(), 0);
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		const Line& line = lines[i];
+		if (line.kind != Line::LABEL || seen[line.symbol])
+			continue;
+		seen[line.symbol] = 1;
+		if (symbols.getValue(line.symbol) != line.address)
+		{
+			symbols.setValue(line.symbol, line.address);
+			changed->push_back(line.symbol);
+		}
+	}
+	return;
+}
+
+/**
+ * Gives every variable its register, in the order of first use.
+ *
+ * @param changed The variables whose register changed are added.
+ */
+void IncrementalAssembler::assignVariables(vector<int>* changed)
+{
+	vector<char> seen(symbols.size(), 0);
+	int varCounter = 0;
+	for (size_t i = 0; i < references.size(); i++)
+	{
+		int symbol = references[i];
+		if (symbol < 0 || seen[symbol] || !isVariable(symbol))
+			continue;
+		seen[symbol] = 1;
+		int value = Resolver::VAR_ASSIGN_ADD_START + varCounter++;
+		if (symbols.getValue(symbol) != value)
+		{
+			symbols.setValue(symbol, value);
+			changed->push_back(symbol);
+		}
+	}
+	return;
+}
+
+/**
+ * @return true if every command is valid, so getWords is the hack code.
+ */
+bool IncrementalAssembler::isValid()
+{
+	return invalidCount == 0;
+}
+
+/**
+ * @return Why the source is invalid, as a full assembly would report it, or an empty string.
+ */
+string IncrementalAssembler::getError()
+{
+	int line = getErrorLine();
+	return (line == 0) ? "" : invalidTexts[lines[line - 1].symbol];
+}
+
+/**
+ * @return The number of the first line with an invalid command, or 0 if there is none.
+ */
+int IncrementalAssembler::getErrorLine()
+{
+	if (invalidCount == 0)
+		return 0;
+	for (size_t i = 0; i < lines.size(); i++)
+	{
+		if (lines[i].kind == Line::INVALID)
+			return (int)i + 1;
+	}
+	return 0;
+}
+
+/**
+ * @return The hack code, one word per command. Only meaningful if isValid.
+ */
+const vector<uint16_t>& IncrementalAssembler::getWords()
+{
+	return words;
+}
+
+/**
+ * @return The number of lines in the source.
+ */
+int IncrementalAssembler::getLineCount()
+{
+	return (int)lines.size();
+}
+
+/**
+ * @return The number of words encoded or patched by the last load or edit.
+ */
+size_t IncrementalAssembler::getEncodedCount()
+{
+	return encodedCount;
+}
@@ -0,0 +1,336 @@
+/************************************************************************-
+ *	hackObject.cpp, the implementation of ObjectModule and Linker from hackASM.h.
+ *  Assembles sources separately and links them into one program.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <cstring>
+
+/**
+ * @return The little-endian uint32 at bytes.
+ */
+static uint32_t readUint32(const unsigned char* bytes)
+{
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * Writes value at bytes, little-endian.
+ */
+static void writeUint32(unsigned char* bytes, uint32_t value)
+{
+	for (int b = 0; b < 4; b++)
+		bytes[b] = (unsigned char)(value >> (8 * b));
+	return;
+}
+
+ObjectModule::ObjectModule()
+{
+	error = "";
+	errorLine = 0;
+}
+
+/**
+ * Assembles source on its own into this module, replacing what it held.
+ *
+ * @param source The asm code.
+ * @param size The number of chars in source.
+ * @return 0 on success, 1 if a command is invalid; see getError().
+ */
+int ObjectModule::assemble(const char* source, size_t size)
+{
+	words.clear();
+	symbols = SymbolTable();
+	relocations.clear();
+	error = "";
+	errorLine = 0;
+
+	vector<Instruction> commands;
+	vector<Label> labels;
+	string scratch;
+	int length;
+	Resolver::scan(source, 0, size, &commands, &labels);
+	const SymbolTable& predefined = SymbolTable::predefined();
+
+	// Labels, as the source declares them; the first declaration in the module wins.
+	for (size_t i = 0; i < labels.size(); i++)
+	{
+		const char* name = Resolver::compact(source + labels[i].start, labels[i].length, &scratch, &length);
+		if (Resolver::isNumber(name, length) || predefined.lookup(name, length) != SymbolTable::NOT_FOUND)
+			continue;
+		if (symbols.lookup(name, length) == SymbolTable::NOT_FOUND)
+			symbols.add(name, length, labels[i].address);
+	}
+
+	words.resize(commands.size());
+	for (size_t n = 0; n < commands.size(); n++)
+	{
+		const Instruction& command = commands[n];
+		const char* text = source + command.start;
+		if (command.kind == Instruction::A_COMMAND)
+		{
+			const char* name = Resolver::compact(text + 1, command.length - 1, &scratch, &length);
+			int id;
+			if (Resolver::isNumber(name, length))
+				words[n] = (uint16_t)Resolver::parseNumber(name, length);
+			else if ((id = predefined.lookup(name, length)) != SymbolTable::NOT_FOUND)
+				words[n] = (uint16_t)(predefined.getValue(id) & 0x7FFF);
+			else
+			{
+				id = symbols.lookup(name, length);
+				if (id == SymbolTable::NOT_FOUND)
+					id = symbols.add(name, length, SymbolTable::NOT_FOUND);
+				words[n] = 0;
+				relocations.push_back(Relocation{(uint32_t)n, (uint32_t)id});
+			}
+		}
+		else
+		{
+			const char* code = Resolver::compact(text, command.length, &scratch, &length);
+			int encoded = Interpreter::encodeC(code, length);
+			if (encoded == Interpreter::CODE_ERROR)
+			{
+				error = "Invalid command: " + string(code, length);
+				errorLine = command.line;
+				words.clear();
+				return 1;
+			}
+			words[n] = (uint16_t)encoded;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Writes the module as a .hobj file; see the class comment for the layout.
+ *
+ * @return The file contents.
+ */
+string ObjectModule::toObject() const
+{
+	size_t symbolCount = symbols.size();
+	size_t nameBytes = 0;
+	for (size_t id = 0; id < symbolCount; id++)
+		nameBytes += symbols.getName((int)id).size();
+	size_t symbolsAt = HEADER_SIZE;
+	size_t relocationsAt = symbolsAt + symbolCount * 12;
+	size_t wordsAt = relocationsAt + relocations.size() * 8;
+	size_t namesAt = wordsAt + words.size() * 2;
+
+	string output(namesAt + nameBytes, '\0');
+	unsigned char* bytes = (unsigned char*)&output[0];
+	memcpy(bytes, "HOBJ", 4);
+	writeUint32(bytes + 4, 1 | (uint32_t)HEADER_SIZE << 16); // Version and header size.
+	writeUint32(bytes + 8, (uint32_t)words.size());
+	writeUint32(bytes + 12, (uint32_t)symbolCount);
+	writeUint32(bytes + 16, (uint32_t)relocations.size());
+	writeUint32(bytes + 20, (uint32_t)nameBytes);
+
+	size_t nameOffset = 0;
+	for (size_t id = 0; id < symbolCount; id++)
+	{
+		string_view name = symbols.getName((int)id);
+		unsigned char* symbol = bytes + symbolsAt + id * 12;
+		writeUint32(symbol, (uint32_t)nameOffset);
+		writeUint32(symbol + 4, (uint32_t)name.size());
+		writeUint32(symbol + 8, (uint32_t)symbols.getValue((int)id)); // NOT_FOUND is written as -1.
+		memcpy(bytes + namesAt + nameOffset, name.data(), name.size());
+		nameOffset += name.size();
+	}
+	for (size_t i = 0; i < relocations.size(); i++)
+	{
+		writeUint32(bytes + relocationsAt + i * 8, relocations[i].word);
+		writeUint32(bytes + relocationsAt + i * 8 + 4, relocations[i].symbol);
+	}
+	for (size_t i = 0; i < words.size(); i++)
+	{
+		bytes[wordsAt + 2 * i] = (unsigned char)words[i];
+		bytes[wordsAt + 2 * i + 1] = (unsigned char)(words[i] >> 8);
+	}
+	return output;
+}
+
+/**
+ * Checks a .hobj file and reads it into this module, replacing what it held.
+ *
+ * @param data The file contents.
+ * @param size The number of bytes in data.
+ * @return 0 on success, 1 if data is not a valid object module; see getError().
+ */
+int ObjectModule::read(const char* data, size_t size)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	words.clear();
+	symbols = SymbolTable();
+	relocations.clear();
+	error = "Not a valid object module";
+	errorLine = 0;
+	if (size < HEADER_SIZE || memcmp(data, "HOBJ", 4) != 0)
+		return 1;
+	uint32_t version = readUint32(bytes + 4);
+	size_t headerSize = version >> 16;
+	size_t wordCount = readUint32(bytes + 8);
+	size_t symbolCount = readUint32(bytes + 12);
+	size_t relocationCount = readUint32(bytes + 16);
+	size_t nameBytes = readUint32(bytes + 20);
+	if ((version & 0xFFFF) != 1 || headerSize < HEADER_SIZE || size < headerSize)
+		return 1;
+	// Each part in turn must fit in what is left, which also keeps the offsets from overflowing.
+	size_t left = size - headerSize;
+	if (left / 12 < symbolCount)
+		return 1;
+	left -= symbolCount * 12;
+	if (left / 8 < relocationCount)
+		return 1;
+	left -= relocationCount * 8;
+	if (left / 2 < wordCount)
+		return 1;
+	left -= wordCount * 2;
+	if (left < nameBytes)
+		return 1;
+	const unsigned char* symbolData = bytes + headerSize;
+	const unsigned char* relocationData = symbolData + symbolCount * 12;
+	const unsigned char* wordData = relocationData + relocationCount * 8;
+	const char* names = (const char*)(wordData + wordCount * 2);
+
+	for (size_t id = 0; id < symbolCount; id++)
+	{
+		size_t offset = readUint32(symbolData + id * 12);
+		size_t length = readUint32(symbolData + id * 12 + 4);
+		int address = (int)readUint32(symbolData + id * 12 + 8);
+		if (offset > nameBytes || length > nameBytes - offset
+			|| (address < 0 && address != SymbolTable::NOT_FOUND) || (address >= 0 && (size_t)address > wordCount)
+			|| symbols.lookup(names + offset, (int)length) != SymbolTable::NOT_FOUND)
+			return 1;
+		symbols.add(names + offset, (int)length, address);
+	}
+	relocations.resize(relocationCount);
+	for (size_t i = 0; i < relocationCount; i++)
+	{
+		relocations[i].word = readUint32(relocationData + i * 8);
+		relocations[i].symbol = readUint32(relocationData + i * 8 + 4);
+		if (relocations[i].word >= wordCount || relocations[i].symbol >= symbolCount)
+			return 1;
+	}
+	words.resize(wordCount);
+	for (size_t i = 0; i < wordCount; i++)
+		words[i] = (uint16_t)(wordData[2 * i] | wordData[2 * i + 1] << 8);
+	error = "";
+	return 0;
+}
+
+const vector<uint16_t>& ObjectModule::getWords() const
+{
+	return words;
+}
+
+/**
+ * @return The labels the module declares and the symbols it only uses, by the ids its relocations name.
+ */
+const SymbolTable& ObjectModule::getSymbols() const
+{
+	return symbols;
+}
+
+const vector<ObjectModule::Relocation>& ObjectModule::getRelocations() const
+{
+	return relocations;
+}
+
+/**
+ * @return The reason assemble or read failed, or an empty string.
+ */
+string ObjectModule::getError()
+{
+	return error;
+}
+
+/**
+ * @return The line number of the invalid command that made assemble fail.
+ */
+int ObjectModule::getErrorLine()
+{
+	return errorLine;
+}
+
+// Linker:
+
+Linker::Linker()
+{
+	varCount = 0;
+}
+
+/**
+ * Links modules, in order, into one program.
+ * The first pass places the modules and adds their labels; the second walks the relocations,
+ * which are in ROM order, numbering variables as they are first used and patching the words.
+ *
+ * @param modules The modules, in the order their sources would be in.
+ * @param words Set to the hack code.
+ */
+void Linker::link(const vector<ObjectModule>& modules, vector<uint16_t>* words)
+{
+	symbols = SymbolTable::predefined();
+	varCount = 0;
+	vector<vector<int>> ids(modules.size()); // The linked id of each module symbol.
+	vector<size_t> bases(modules.size());
+	size_t total = 0;
+	for (size_t m = 0; m < modules.size(); m++)
+	{
+		const SymbolTable& local = modules[m].getSymbols();
+		bases[m] = total;
+		ids[m].resize(local.size());
+		for (int id = 0; id < local.size(); id++)
+		{
+			string_view name = local.getName(id);
+			int address = local.getValue(id);
+			int value = (address == SymbolTable::NOT_FOUND) ? SymbolTable::NOT_FOUND : (int)total + address;
+			int global = symbols.lookup(name.data(), (int)name.size());
+			if (global == SymbolTable::NOT_FOUND)
+				global = symbols.add(name.data(), (int)name.size(), value);
+			else if (symbols.getValue(global) == SymbolTable::NOT_FOUND) // Only used so far; the first declaration wins.
+				symbols.setValue(global, value);
+			ids[m][id] = global;
+		}
+		total += modules[m].getWords().size();
+	}
+
+	words->resize(total);
+	for (size_t m = 0; m < modules.size(); m++)
+	{
+		const vector<uint16_t>& moduleWords = modules[m].getWords();
+		if (!moduleWords.empty())
+			memcpy(words->data() + bases[m], moduleWords.data(), moduleWords.size() * 2);
+		const vector<ObjectModule::Relocation>& relocations = modules[m].getRelocations();
+		for (size_t i = 0; i < relocations.size(); i++)
+		{
+			int global = ids[m][relocations[i].symbol];
+			int value = symbols.getValue(global);
+			if (value == SymbolTable::NOT_FOUND) // Not declared by any module: a variable.
+			{
+				value = Resolver::VAR_ASSIGN_ADD_START + varCount++;
+				symbols.setValue(global, value);
+			}
+			(*words)[bases[m] + relocations[i].word] = (uint16_t)(value & 0x7FFF);
+		}
+	}
+	return;
+}
+
+/**
+ * @return The built-in symbols, labels and variables of the last link.
+ */
+const SymbolTable& Linker::getSymbols()
+{
+	return symbols;
+}
+
+/**
+ * @return The number of variables the last link numbered.
+ */
+int Linker::getVarCount()
+{
+	return varCount;
+}
@@ -0,0 +1,205 @@
+/************************************************************************-
+ *	hackOptimize.cpp, the implementation of Optimizer from hackASM.h.
+ *  A peephole pass over encoded instructions, so programs take fewer HACK CPU cycles.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+
+static const int UNKNOWN = -1;
+static const int LABEL_KEY = 0x10000; // Added to a label's symbol id, so labels never equal a number.
+
+Optimizer::Optimizer()
+{
+	overwrittenCount = 0;
+	reloadCount = 0;
+	jumpCount = 0;
+}
+
+/**
+ * Links module on its own, as Linker would, leaving out the instructions that do nothing.
+ * Variables get the same registers as without optimizing, so the program's RAM is laid out the same.
+ *
+ * @param module The program.
+ * @param words Set to the hack code.
+ */
+void Optimizer::optimize(const ObjectModule& module, vector<uint16_t>* words)
+{
+	overwrittenCount = 0;
+	reloadCount = 0;
+	jumpCount = 0;
+	const vector<uint16_t>& code = module.getWords();
+	const SymbolTable& symbols = module.getSymbols();
+	const vector<ObjectModule::Relocation>& relocations = module.getRelocations();
+	int count = (int)code.size();
+
+	// What each A command loads: a number, or a label whose address is not known yet.
+	vector<int> keys(count, UNKNOWN);
+	vector<int> values(symbols.size(), UNKNOWN); // Registers of the variables.
+	int varCounter = 0;
+	for (int i = 0; i < count; i++)
+	{
+		if ((code[i] & 0x8000) == 0)
+			keys[i] = code[i];
+	}
+	for (size_t r = 0; r < relocations.size(); r++)
+	{
+		int symbol = (int)relocations[r].symbol;
+		if (symbols.getValue(symbol) != SymbolTable::NOT_FOUND)
+			keys[relocations[r].word] = LABEL_KEY + symbol;
+		else
+		{
+			if (values[symbol] == UNKNOWN)
+				values[symbol] = Resolver::VAR_ASSIGN_ADD_START + varCounter++;
+			keys[relocations[r].word] = values[symbol];
+		}
+	}
+	vector<char> targets(count + 1, 0);
+	for (int id = 0; id < symbols.size(); id++)
+	{
+		if (symbols.getValue(id) != SymbolTable::NOT_FOUND)
+			targets[symbols.getValue(id)] = 1;
+	}
+
+	// The instructions left, as a linked list, so the removed ones are skipped.
+	vector<int> next(count + 1);
+	vector<int> previous(count + 1);
+	for (int i = 0; i <= count; i++)
+	{
+		next[i] = i + 1;
+		previous[i] = i - 1;
+	}
+	int first = 0;
+	vector<int> knownAfter(count, UNKNOWN); // What A holds after each instruction left, if every way there leaves the same.
+
+	// Which removal, if any, applies to instruction i: 1 overwritten, 2 reload, 3 jump to the next instruction.
+	auto check = [&](int i)
+	{
+		int known = (targets[i] || previous[i] < 0) ? UNKNOWN : knownAfter[previous[i]];
+		uint16_t word = code[i];
+		if ((word & 0x8000) == 0)
+		{
+			if (next[i] < count && (code[next[i]] & 0x8000) == 0)
+				return 1;
+			if (known == keys[i])
+				return 2;
+			knownAfter[i] = keys[i];
+			return 0;
+		}
+		int dest = (word >> 3) & 7;
+		int jump = word & 7;
+		if (jump != 0 && dest == 0 && known >= LABEL_KEY)
+		{
+			int address = symbols.getValue(known - LABEL_KEY);
+			if (address > i && next[i] >= address) // Nothing left between the jump and its label.
+				return 3;
+		}
+		knownAfter[i] = (dest & 4) ? UNKNOWN : known; // dest & 4 writes A.
+		return 0;
+	};
+	auto remove = [&](int i, int kind)
+	{
+		if (kind == 1)
+			overwrittenCount++;
+		else if (kind == 2)
+			reloadCount++;
+		else
+			jumpCount++;
+		if (previous[i] >= 0)
+			next[previous[i]] = next[i];
+		else
+			first = next[i];
+		previous[next[i]] = previous[i];
+		if (targets[i]) // Its labels now point at the next instruction left.
+			targets[next[i]] = 1;
+		return;
+	};
+
+	// One pass is enough: removing an instruction leaves what A holds everywhere else the same,
+	// and can only make the instruction before it removable, such as an A command before a removed jump.
+	for (int i = first; i < count; i = next[i])
+	{
+		int kind = check(i);
+		if (kind == 0)
+			continue;
+		remove(i, kind);
+		for (int p = previous[i]; p >= 0 && (kind = check(p)) != 0; p = previous[p])
+			remove(p, kind);
+	}
+
+	// Place the labels again, counting only what is left, and write the words.
+	vector<int> addresses(count + 1, 0);
+	int address = 0;
+	for (int i = 0, left = first; i < count; i++)
+	{
+		addresses[i] = address;
+		if (i == left)
+		{
+			address++;
+			left = next[i];
+		}
+	}
+	addresses[count] = address;
+	vector<int> relocated(count, UNKNOWN);
+	for (size_t r = 0; r < relocations.size(); r++)
+		relocated[relocations[r].word] = (int)relocations[r].symbol;
+	words->clear();
+	words->reserve(address);
+	origins.clear();
+	origins.reserve(address);
+	for (int i = first; i < count; i = next[i])
+	{
+		origins.push_back(i);
+		if (keys[i] >= LABEL_KEY)
+			words->push_back((uint16_t)(addresses[symbols.getValue(relocated[i])] & 0x7FFF));
+		else if (relocated[i] != UNKNOWN)
+			words->push_back((uint16_t)(keys[i] & 0x7FFF));
+		else
+			words->push_back(code[i]);
+	}
+	return;
+}
+
+/**
+ * @return The instructions the last optimize took out; each was a cycle every time it ran.
+ */
+size_t Optimizer::getRemovedCount()
+{
+	return overwrittenCount + reloadCount + jumpCount;
+}
+
+/**
+ * @return The A commands taken out as the next instruction is another A command.
+ */
+size_t Optimizer::getOverwrittenCount()
+{
+	return overwrittenCount;
+}
+
+/**
+ * @return The A commands taken out as A already held their value.
+ */
+size_t Optimizer::getReloadCount()
+{
+	return reloadCount;
+}
+
+/**
+ * @return The jumps to the next instruction taken out.
+ */
+size_t Optimizer::getJumpCount()
+{
+	return jumpCount;
+}
+
+/**
+ * Gets where each word of the last optimize came from, to map profiles and listings back to the source.
+ * A label at module index i is now at the number of origins below i.
+ *
+ * @return The index in the module of each word, in order.
+ */
+const vector<int>& Optimizer::getOrigins()
+{
+	return origins;
+}
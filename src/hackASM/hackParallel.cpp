@@ -0,0 +1,230 @@
+/************************************************************************-
+ *	hackParallel.cpp, the implementation of ParallelAssembler from hackASM.h.
+ *  Assembles a single large source on several threads.
+ * 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+
+/**
+ * @param threads The number of threads to use. Values below 1 use one per hardware thread.
+ */
+ParallelAssembler::ParallelAssembler(int threads)
+{
+	threadCount = (threads < 1) ? WorkPool::defaultThreadCount() : threads;
+	error = "";
+	errorLine = 0;
+}
+
+/**
+ * Splits source into chunks of about equal size, each starting at the beginning of a line.
+ * There are a few chunks per thread, so threads that finish early can steal the rest.
+ *
+ * @param source The asm code.
+ * @param size The number of chars in source.
+ * @param chunks Filled with the chunk ranges.
+ */
+void ParallelAssembler::split(const char* source, size_t size, vector<Chunk>* chunks)
+{
+	size_t count = min((size_t)threadCount * 4, size / MIN_CHUNK_SIZE);
+	if (count < 1)
+		count = 1;
+	chunks->resize(count);
+	
+	size_t begin = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		size_t end = (i == count - 1) ? size : size / count * (i + 1);
+		if (end < begin)
+			end = begin;
+		while (end < size && source[end - 1] != '\n') // Move the end past the next new line.
+			end++;
+		(*chunks)[i].begin = begin;
+		(*chunks)[i].end = end;
+		begin = end;
+	}
+	return;
+}
+
+/**
+ * Encodes every command in chunk into words, at the chunk's base.
+ * A commands using a variable are left for later, in chunk->pending, as their register is not known yet.
+ * Only reads this->symbols, so chunks can be encoded at once.
+ *
+ * @param source The asm code.
+ * @param chunk The chunk to encode. Its error is set if a command is invalid.
+ * @param words The hack code of the whole source, already sized.
+ */
+void ParallelAssembler::encode(const char* source, Chunk* chunk, vector<uint16_t>* words)
+{
+	string scratch;
+	int length;
+	uint16_t* out = words->data() + chunk->base;
+	
+	for (size_t n = 0; n < chunk->commands.size(); n++)
+	{
+		const Instruction& command = chunk->commands[n];
+		const char* text = source + command.start;
+		if (command.kind == Instruction::A_COMMAND)
+		{
+			const char* name = Resolver::compact(text + 1, command.length - 1, &scratch, &length);
+			if (Resolver::isNumber(name, length))
+			{
+				out[n] = (uint16_t)Resolver::parseNumber(name, length);
+				continue;
+			}
+			int id = symbols.lookup(name, length);
+			if (id != SymbolTable::NOT_FOUND)
+			{
+				out[n] = (uint16_t)(symbols.getValue(id) & 0x7FFF);
+				continue;
+			}
+			id = chunk->unresolved.find(name, length);
+			if (id == SymbolTable::NOT_FOUND)
+				id = chunk->unresolved.add(name, length, SymbolTable::NOT_FOUND);
+			chunk->pending.push_back(make_pair((int)n, id));
+		}
+		else
+		{
+			const char* code = Resolver::compact(text, command.length, &scratch, &length);
+			int word = Interpreter::encodeC(code, length);
+			if (word == Interpreter::CODE_ERROR)
+			{
+				chunk->error = "Invalid command: " + string(code, length);
+				chunk->errorLine = command.line;
+				return;
+			}
+			out[n] = (uint16_t)word;
+		}
+	}
+	vector<Instruction>().swap(chunk->commands); // The commands are no longer needed.
+	return;
+}
+
+/**
+ * Assembles source into words.
+ *
+ * @param source The asm code.
+ * @param size The number of chars in source.
+ * @param words Set to the hack code, one word per command.
+ * @param stats If not NULL, the stage times and counts are saved here.
+ * @return 0 on success, 1 if a command is invalid; see getError().
+ */
+int ParallelAssembler::assemble(const char* source, size_t size, vector<uint16_t>* words, AssemblyStats* stats)
+{
+	double start = (stats != NULL) ? AssemblyStats::now() : 0;
+	vector<Chunk> chunks;
+	split(source, size, &chunks);
+	vector<size_t> costs(chunks.size());
+	for (size_t i = 0; i < chunks.size(); i++)
+		costs[i] = chunks[i].end - chunks[i].begin;
+	WorkPool pool(threadCount);
+	
+	// Scan every chunk.
+	pool.run(costs, [&](size_t task, int)
+	{
+		Chunk& chunk = chunks[task];
+		chunk.commands.reserve((chunk.end - chunk.begin) / 8);
+		chunk.newLines = Resolver::scan(source, chunk.begin, chunk.end, &chunk.commands, &chunk.labels);
+	});
+	
+	// Give every chunk its ROM base, and add the labels in declaration order.
+	symbols = SymbolTable::predefined();
+	string scratch;
+	int length;
+	int base = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		chunks[i].base = base;
+		for (size_t j = 0; j < chunks[i].labels.size(); j++)
+		{
+			const Label& label = chunks[i].labels[j];
+			const char* name = Resolver::compact(source + label.start, label.length, &scratch, &length);
+			if (!Resolver::isNumber(name, length) && symbols.find(name, length) == SymbolTable::NOT_FOUND)
+				symbols.add(name, length, base + label.address);
+		}
+		base += (int)chunks[i].commands.size();
+	}
+	words->assign(base, 0);
+	int labelCount = symbols.size() - SymbolTable::predefined().size();
+	double scanned = (stats != NULL) ? AssemblyStats::now() : 0;
+	
+	// Encode every chunk.
+	pool.run(costs, [&](size_t task, int)
+	{
+		encode(source, &chunks[task], words);
+	});
+	int firstLine = 1;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!chunks[i].error.empty()) // The first invalid command in the source, as Interpreter would report.
+		{
+			error = chunks[i].error;
+			errorLine = firstLine + chunks[i].errorLine - 1;
+			words->clear();
+			return 1;
+		}
+		firstLine += chunks[i].newLines;
+	}
+	double encoded = (stats != NULL) ? AssemblyStats::now() : 0;
+	
+	// Give the variables their registers in first use order.
+	int varCounter = 0;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		SymbolTable& unresolved = chunks[i].unresolved;
+		for (int id = 0; id < unresolved.size(); id++)
+		{
+			string_view name = unresolved.getName(id); // Stays valid, as only this->symbols grows.
+			int global = symbols.find(name.data(), (int)name.size());
+			if (global == SymbolTable::NOT_FOUND)
+				global = symbols.add(name.data(), (int)name.size(), Resolver::VAR_ASSIGN_ADD_START + varCounter++);
+			unresolved.setValue(id, symbols.getValue(global));
+		}
+	}
+	
+	// Fill in the variables.
+	pool.run(costs, [&](size_t task, int)
+	{
+		Chunk& chunk = chunks[task];
+		uint16_t* out = words->data() + chunk.base;
+		for (size_t n = 0; n < chunk.pending.size(); n++)
+			out[chunk.pending[n].first] = (uint16_t)(chunk.unresolved.getValue(chunk.pending[n].second) & 0x7FFF);
+	});
+	
+	if (stats != NULL) // Encoding comes before resolving variables here, unlike in Resolver.
+	{
+		stats->scanSeconds = scanned - start;
+		stats->encodeSeconds = encoded - scanned;
+		stats->resolveSeconds = AssemblyStats::now() - encoded;
+		stats->lines = firstLine;
+		stats->labels = labelCount;
+		stats->variables = varCounter;
+	}
+	return 0;
+}
+
+/**
+ * @return The reason assemble failed, or an empty string.
+ */
+string ParallelAssembler::getError()
+{
+	return error;
+}
+
+/**
+ * @return The line number of the invalid command that made assemble fail.
+ */
+int ParallelAssembler::getErrorLine()
+{
+	return errorLine;
+}
+
+/**
+ * @return The built-in symbols, labels and variables of the last assembled source.
+ */
+const SymbolTable& ParallelAssembler::getSymbols()
+{
+	return symbols;
+}
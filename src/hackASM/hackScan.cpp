@@ -0,0 +1,341 @@
+/************************************************************************-
+ *	hackScan.cpp, the implementation of Scanner from hackASM.h.
+ *  Most asm from a compiler is comments and indentation, so this is where the front end spends its time.
+ * 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HACK_SCAN_X86
+#include <immintrin.h>
+#endif
+
+const size_t Scanner::BLOCK_SIZE;
+const size_t Scanner::GROUP_SIZE;
+
+int Scanner::mode = Scanner::bestMode();
+
+/**
+ * @return The fastest mode this CPU supports.
+ */
+int Scanner::bestMode()
+{
+#ifdef HACK_SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return MODE_AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return MODE_SSE2;
+#endif
+	return MODE_SCALAR;
+}
+
+/**
+ * @return The mode scan uses.
+ */
+int Scanner::getMode()
+{
+	return mode;
+}
+
+/**
+ * Picks the mode scan uses, as for comparing them. A mode this CPU does not support falls back to bestMode().
+ *
+ * @param mode MODE_SCALAR, MODE_SSE2 or MODE_AVX2.
+ */
+void Scanner::setMode(int mode)
+{
+	int best = bestMode();
+	Scanner::mode = (mode < MODE_SCALAR || mode > best) ? best : mode;
+	return;
+}
+
+/**
+ * Scans source from begin to end, skipping whitespace, empty lines, and comments.
+ * See Resolver::scan.
+ *
+ * @return The number of new line chars scanned.
+ */
+int Scanner::scan(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels)
+{
+	switch (mode)
+	{
+		case MODE_AVX2: return scanMasks(source, begin, end, commands, labels, classifyAVX2);
+		case MODE_SSE2: return scanMasks(source, begin, end, commands, labels, classifySSE2);
+		default:        return scanScalar(source, begin, end, commands, labels);
+	}
+}
+
+/**
+ * Adds the line from start to last as a label declaration or a command.
+ *
+ * @param source The asm code.
+ * @param start Offset of the first char of the line that is not whitespace.
+ * @param last Offset one past the last char that is not whitespace or part of a comment.
+ * @param line The line number.
+ * @param count The number of commands found so far; increased if this is a command.
+ * @param commands Commands are added to the back.
+ * @param labels Label declarations are added to the back.
+ */
+inline void Scanner::emit(const char* source, size_t start, size_t last, int line, int* count, vector<Instruction>* commands, vector<Label>* labels)
+{
+	if (source[start] == '(') // Label declaration; it points to the next command.
+	{
+		size_t close = start + 1;
+		while (close < last && source[close] != ')')
+			close++;
+		Label label;
+		label.start = start + 1;
+		label.length = (int)(close - start - 1);
+		label.address = *count;
+		labels->push_back(label);
+		return;
+	}
+	
+	Instruction command;
+	command.start = start;
+	command.length = (int)(last - start);
+	command.kind = (source[start] == '@') ? Instruction::A_COMMAND : Instruction::C_COMMAND;
+	command.line = line;
+	commands->push_back(command);
+	(*count)++;
+	return;
+}
+
+/**
+ * Scans one char at a time.
+ */
+int Scanner::scanScalar(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels)
+{
+	size_t i = begin;
+	int line = 1;
+	int count = 0; // Number of commands found so far.
+	
+	while (i < end) // Iterate through source once.
+	{
+		char curChar = source[i];
+		if (curChar == '\n')
+		{
+			line++;
+			i++;
+			continue;
+		}
+		if (Resolver::isBlank(curChar)) // Skip white space before a command.
+		{
+			i++;
+			continue;
+		}
+		
+		size_t start = i;
+		size_t last = i; // One past the last char that is not white space.
+		while (i < end && source[i] != '\n') // Find the end of the line, or the start of a comment.
+		{
+			curChar = source[i];
+			if (curChar == '/' && i + 1 < end && source[i+1] == '/')
+			{
+				while (i < end && source[i] != '\n') // Skip the rest of the line.
+					i++;
+				break;
+			}
+			if (!Resolver::isBlank(curChar))
+				last = i + 1;
+			i++;
+		}
+		if (last == start) // The line was only a comment.
+			continue;
+		emit(source, start, last, line, &count, commands, labels);
+	}
+	return line - 1;
+}
+
+/**
+ * Scans with masks built by classify, a group of blocks at a time.
+ * For each block, bit i of a mask is set if char i of the block is a new line, whitespace, or '/'.
+ * A comment starts at a '/' whose next char is also '/'. The command on a line is the span from 
+ * the first to the last char that is neither, before any comment.
+ */
+int Scanner::scanMasks(const char* source, size_t begin, size_t end, vector<Instruction>* commands, vector<Label>* labels, Classifier classify)
+{
+	uint32_t newLines[GROUP_SIZE];
+	uint32_t blanks[GROUP_SIZE];
+	uint32_t slashes[GROUP_SIZE];
+	
+	int line = 1;
+	int count = 0;
+	bool started = false;   // Found the first char of a command on this line.
+	bool inComment = false; // Past the start of a comment on this line.
+	size_t start = 0;
+	size_t last = 0;
+	
+	for (size_t group = begin; group < end; group += BLOCK_SIZE * GROUP_SIZE)
+	{
+		size_t groupSize = min(end - group, BLOCK_SIZE * GROUP_SIZE);
+		size_t blocks = (groupSize + BLOCK_SIZE - 1) / BLOCK_SIZE;
+		classify(source + group, groupSize, newLines, blanks, slashes);
+		
+		for (size_t k = 0; k < blocks; k++)
+		{
+			size_t pos = group + k * BLOCK_SIZE;
+			size_t size = min(end - pos, BLOCK_SIZE);
+			uint32_t valid = (size == BLOCK_SIZE) ? 0xFFFFFFFFu : ((1u << size) - 1);
+			uint32_t newLine = newLines[k];
+			uint32_t content = ~(newLine | blanks[k]) & valid;
+			uint32_t nextSlash; // 1 if the char after this block is '/'.
+			if (k + 1 < blocks)
+				nextSlash = slashes[k + 1] & 1;
+			else
+				nextSlash = (pos + BLOCK_SIZE < end && source[pos + BLOCK_SIZE] == '/') ? 1 : 0;
+			uint32_t comment = slashes[k] & ((slashes[k] >> 1) | (nextSlash << 31));
+			
+			if (inComment && newLine == 0) // The whole block is inside a comment.
+				continue;
+			
+			uint32_t cur = 0; // Bit of the first char of the block not yet looked at.
+			while (true)
+			{
+				uint32_t rest = 0xFFFFFFFFu << cur;
+				uint32_t ends = newLine & rest;
+				uint32_t e = ends ? (uint32_t)__builtin_ctz(ends) : 32; // Bit of the new line ending this line.
+				uint32_t segment = (e == 32) ? rest : (rest & ((1u << e) - 1));
+				if (!inComment)
+				{
+					uint32_t slash = comment & segment;
+					uint32_t region = slash ? (segment & ((1u << __builtin_ctz(slash)) - 1)) : segment;
+					uint32_t chars = content & region;
+					if (chars != 0)
+					{
+						if (!started)
+						{
+							started = true;
+							start = pos + __builtin_ctz(chars);
+						}
+						last = pos + (31 - __builtin_clz(chars)) + 1;
+					}
+					if (slash != 0)
+						inComment = true;
+				}
+				if (e == 32) // The line goes on in the next block.
+					break;
+				
+				if (started)
+					emit(source, start, last, line, &count, commands, labels);
+				started = false;
+				inComment = false;
+				line++;
+				cur = e + 1;
+				if (cur == 32)
+					break;
+			}
+		}
+	}
+	if (started) // The last line has no new line.
+		emit(source, start, last, line, &count, commands, labels);
+	return line - 1;
+}
+
+/**
+ * Builds the masks one char at a time; used for the end of a range that does not fill a whole block.
+ *
+ * @param source The first char to classify.
+ * @param size The number of chars to classify.
+ * @param newLines Set to the new line mask of every block.
+ * @param blanks Set to the whitespace mask of every block.
+ * @param slashes Set to the '/' mask of every block.
+ */
+void Scanner::classifyScalar(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes)
+{
+	size_t blocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+	for (size_t k = 0; k < blocks; k++)
+	{
+		newLines[k] = 0;
+		blanks[k] = 0;
+		slashes[k] = 0;
+	}
+	for (size_t i = 0; i < size; i++)
+	{
+		uint32_t bit = 1u << (i % BLOCK_SIZE);
+		char c = source[i];
+		if (c == '\n')
+			newLines[i / BLOCK_SIZE] |= bit;
+		else if (Resolver::isBlank(c))
+			blanks[i / BLOCK_SIZE] |= bit;
+		else if (c == '/')
+			slashes[i / BLOCK_SIZE] |= bit;
+	}
+	return;
+}
+
+#ifdef HACK_SCAN_X86
+/**
+ * Builds the masks 16 chars at a time with SSE2.
+ */
+__attribute__((target("sse2")))
+void Scanner::classifySSE2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes)
+{
+	const __m128i newLine = _mm_set1_epi8('\n');
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i carriage = _mm_set1_epi8('\r');
+	const __m128i slash = _mm_set1_epi8('/');
+	
+	size_t full = size / BLOCK_SIZE;
+	for (size_t k = 0; k < full; k++)
+	{
+		const char* p = source + k * BLOCK_SIZE;
+		__m128i low = _mm_loadu_si128((const __m128i*)p);
+		__m128i high = _mm_loadu_si128((const __m128i*)(p + 16));
+		
+		uint32_t lowBlank = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(low, space), _mm_cmpeq_epi8(low, tab)), _mm_cmpeq_epi8(low, carriage)));
+		uint32_t highBlank = (uint32_t)_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(
+			_mm_cmpeq_epi8(high, space), _mm_cmpeq_epi8(high, tab)), _mm_cmpeq_epi8(high, carriage)));
+		
+		newLines[k] = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(low, newLine)) | 
+			(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(high, newLine)) << 16;
+		blanks[k] = lowBlank | highBlank << 16;
+		slashes[k] = (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(low, slash)) | 
+			(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(high, slash)) << 16;
+	}
+	if (full * BLOCK_SIZE < size)
+		classifyScalar(source + full * BLOCK_SIZE, size - full * BLOCK_SIZE, newLines + full, blanks + full, slashes + full);
+	return;
+}
+
+/**
+ * Builds the masks 32 chars at a time with AVX2.
+ */
+__attribute__((target("avx2")))
+void Scanner::classifyAVX2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes)
+{
+	const __m256i newLine = _mm256_set1_epi8('\n');
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i carriage = _mm256_set1_epi8('\r');
+	const __m256i slash = _mm256_set1_epi8('/');
+	
+	size_t full = size / BLOCK_SIZE;
+	for (size_t k = 0; k < full; k++)
+	{
+		__m256i chars = _mm256_loadu_si256((const __m256i*)(source + k * BLOCK_SIZE));
+		newLines[k] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, newLine));
+		blanks[k] = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(
+			_mm256_cmpeq_epi8(chars, space), _mm256_cmpeq_epi8(chars, tab)), _mm256_cmpeq_epi8(chars, carriage)));
+		slashes[k] = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(chars, slash));
+	}
+	if (full * BLOCK_SIZE < size)
+		classifyScalar(source + full * BLOCK_SIZE, size - full * BLOCK_SIZE, newLines + full, blanks + full, slashes + full);
+	return;
+}
+#else
+void Scanner::classifySSE2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes)
+{
+	classifyScalar(source, size, newLines, blanks, slashes);
+}
+
+void Scanner::classifyAVX2(const char* source, size_t size, uint32_t* newLines, uint32_t* blanks, uint32_t* slashes)
+{
+	classifyScalar(source, size, newLines, blanks, slashes);
+}
+#endif
@@ -0,0 +1,627 @@
+/************************************************************************-
+ *	hackServer.cpp, the implementation of AssemblyServer and AssemblyClient from hackASM.h.
+ *  Kept apart from hackASM.cpp as sockets are platform specific; on Windows both only report an error.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+static const char* UNSUPPORTED = "The assembler server is not supported on Windows";
+#else
+/**
+ * Writes all of data to fd, however many calls it takes.
+ *
+ * @return true on success, false if the connection closed.
+ */
+static bool writeAll(int fd, const char* data, size_t size)
+{
+	while (size > 0)
+	{
+		ssize_t count = ::write(fd, data, size);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		data += count;
+		size -= (size_t)count;
+	}
+	return true;
+}
+
+/**
+ * Reads from fd until buffer holds at least size bytes past start.
+ * The bytes before start, already used, are dropped first, once per call rather than once per line.
+ *
+ * @param buffer Bytes received; grows as more arrive.
+ * @param start The offset of the first byte of buffer not yet used; set to 0 once they are dropped.
+ * @return true on success, false if the connection closed first.
+ */
+static bool fill(int fd, string* buffer, size_t* start, size_t size)
+{
+	if (*start > 0)
+	{
+		buffer->erase(0, *start);
+		*start = 0;
+	}
+	char block[1 << 16];
+	while (buffer->size() < size)
+	{
+		ssize_t count = ::read(fd, block, sizeof(block));
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return false;
+		buffer->append(block, (size_t)count);
+	}
+	return true;
+}
+
+static const int LINE_READ = 0;
+static const int LINE_CLOSED = 1;   // The connection closed before a whole line arrived.
+static const int LINE_TOO_LONG = 2; // More than AssemblyServer::MAX_LINE_LENGTH bytes came without a new line.
+
+/**
+ * Takes the next line, without its new line, from buffer, reading more from fd as needed.
+ *
+ * @param start The offset in buffer of the first byte not yet used; moved past the line.
+ * @return LINE_READ, LINE_CLOSED or LINE_TOO_LONG.
+ */
+static int readLine(int fd, string* buffer, size_t* start, string* line)
+{
+	size_t searched = 0; // Past *start, which fill may move.
+	size_t end;
+	while ((end = buffer->find('\n', *start + searched)) == string::npos)
+	{
+		searched = buffer->size() - *start;
+		if (searched > AssemblyServer::MAX_LINE_LENGTH)
+			return LINE_TOO_LONG;
+		if (!fill(fd, buffer, start, searched + 1))
+			return LINE_CLOSED;
+	}
+	if (end - *start > AssemblyServer::MAX_LINE_LENGTH)
+		return LINE_TOO_LONG;
+	line->assign(*buffer, *start, end - *start);
+	*start = end + 1;
+	return LINE_READ;
+}
+
+/**
+ * Takes the next size bytes from buffer, reading more from fd as needed.
+ *
+ * @param start The offset in buffer of the first byte not yet used; moved past the bytes.
+ * @return true on success, false if the connection closed first.
+ */
+static bool readBytes(int fd, string* buffer, size_t* start, size_t size, string* bytes)
+{
+	if (buffer->size() - *start < size && !fill(fd, buffer, start, size))
+		return false;
+	bytes->assign(*buffer, *start, size);
+	*start += size;
+	return true;
+}
+
+/**
+ * @return An answer of the protocol: OK or ERROR with the size of payload, then payload.
+ */
+static string answer(bool ok, const string& payload)
+{
+	return string(ok ? "OK " : "ERROR ") + to_string(payload.size()) + "\n" + payload;
+}
+
+/**
+ * Parses the count of a BATCH or SOURCE request.
+ *
+ * @param text The digits after the request's name.
+ * @param max The largest count allowed.
+ * @param count Set to the count.
+ * @return true on success, false if text is not a number or it is above max.
+ */
+static bool parseCount(const string& text, unsigned long long max, size_t* count)
+{
+	if (text.empty() || text[0] < '0' || text[0] > '9')
+		return false;
+	errno = 0;
+	char* end;
+	unsigned long long value = strtoull(text.c_str(), &end, 10);
+	if (errno != 0 || *end != '\0' || value > max)
+		return false;
+	*count = (size_t)value;
+	return true;
+}
+
+/**
+ * Fills address with path.
+ *
+ * @return 0 on success, 1 if path is too long for a socket.
+ */
+static int makeAddress(const string& path, struct sockaddr_un* address)
+{
+	memset(address, 0, sizeof(*address));
+	address->sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address->sun_path))
+		return 1;
+	memcpy(address->sun_path, path.c_str(), path.size() + 1);
+	return 0;
+}
+#endif
+
+// AssemblyServer:
+AssemblyServer::AssemblyServer()
+{
+	socketPath = "";
+	threads = 0;
+	cache = NULL;
+	listener = -1;
+	stopping = false;
+	error = "";
+}
+
+/**
+ * Listens on socketPath and serves every connection until a SHUTDOWN request.
+ * A socket file left by a server that is no longer running is replaced.
+ *
+ * @param socketPath The path of the socket.
+ * @return 0 once shut down, 1 if the socket could not be made; see getError().
+ */
+int AssemblyServer::run(const string& socketPath)
+{
+#ifdef _WIN32
+	error = UNSUPPORTED;
+	return 1;
+#else
+	this->socketPath = socketPath;
+	stopping = false;
+	struct sockaddr_un address;
+	if (makeAddress(socketPath, &address) == 1)
+	{
+		error = "Socket path too long: " + socketPath;
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // A client that hangs up only fails its own writes.
+
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0); // Is another server using the socket?
+	if (probe >= 0 && ::connect(probe, (struct sockaddr*)&address, sizeof(address)) == 0)
+	{
+		::close(probe);
+		error = "A server is already running on " + socketPath;
+		return 1;
+	}
+	if (probe >= 0)
+		::close(probe);
+	unlink(socketPath.c_str());
+
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, (struct sockaddr*)&address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		error = "Could not listen on " + socketPath + ": " + strerror(errno);
+		if (listener >= 0)
+			::close(listener);
+		listener = -1;
+		return 1;
+	}
+
+	while (true)
+	{
+		int connection = accept(listener, NULL, NULL);
+		unique_lock<mutex> guard(lock);
+		if (stopping)
+		{
+			if (connection >= 0)
+				::close(connection);
+			break;
+		}
+		if (connection < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			error = string("Could not accept a connection: ") + strerror(errno);
+			stopping = true;
+			break;
+		}
+		connections.push_back(connection);
+		std::thread([this, connection]()
+		{
+			try
+			{
+				serve(connection);
+			}
+			catch (const exception&) // Such as running out of memory; only this client is hung up on.
+			{
+			}
+			lock_guard<mutex> guard(lock);
+			connections.erase(find(connections.begin(), connections.end(), connection));
+			::close(connection);
+			finished.notify_all();
+		}).detach();
+	}
+
+	// Hang up on the clients still connected, and wait for their threads, which use this.
+	unique_lock<mutex> guard(lock);
+	for (size_t i = 0; i < connections.size(); i++)
+		::shutdown(connections[i], SHUT_RDWR);
+	finished.wait(guard, [this]() { return connections.empty(); });
+	::close(listener);
+	listener = -1;
+	unlink(socketPath.c_str());
+	return error.empty() ? 0 : 1;
+#endif
+}
+
+/**
+ * Answers the requests on one connection until the client hangs up.
+ *
+ * @param connection The connected socket.
+ */
+void AssemblyServer::serve(int connection)
+{
+#ifndef _WIN32
+	Assembler assembler; // Kept for the whole connection, so its buffers are reused.
+	assembler.setCache(cache);
+	AssemblyContext context;
+	AssemblyResult result;
+	string buffer;
+	size_t start = 0; // Of the bytes in buffer not yet used.
+	string line;
+	int status;
+	while ((status = readLine(connection, &buffer, &start, &line)) == LINE_READ)
+	{
+		string reply;
+		if (line.compare(0, 9, "ASSEMBLE ") == 0)
+		{
+			string path = line.substr(9);
+			bool ok = (assembler.assemble(&path[0]) == 0);
+			reply = answer(ok, ok ? "" : assembler.getError());
+		}
+		else if (line.compare(0, 6, "BATCH ") == 0)
+		{
+			size_t count;
+			if (!parseCount(line.substr(6), MAX_BATCH_FILES, &count))
+			{
+				reply = answer(false, "BATCH takes a file count up to " + to_string(MAX_BATCH_FILES));
+				writeAll(connection, reply.data(), reply.size());
+				return; // The paths that follow cannot be told from requests.
+			}
+			vector<string> paths(count);
+			for (size_t i = 0; i < paths.size(); i++)
+			{
+				status = readLine(connection, &buffer, &start, &paths[i]);
+				if (status != LINE_READ)
+					break;
+			}
+			if (status != LINE_READ)
+				break;
+			vector<string> errors;
+			assembleBatch(paths, &errors);
+			for (size_t i = 0; i < paths.size(); i++) // One write for the whole batch.
+				reply += answer(errors[i].empty(), errors[i]);
+		}
+		else if (line.compare(0, 7, "SOURCE ") == 0)
+		{
+			string source;
+			size_t size;
+			if (!parseCount(line.substr(7), MAX_SOURCE_SIZE, &size))
+			{
+				reply = answer(false, "SOURCE takes a size in bytes up to " + to_string(MAX_SOURCE_SIZE));
+				writeAll(connection, reply.data(), reply.size());
+				return; // The source that follows cannot be told from requests.
+			}
+			if (!readBytes(connection, &buffer, &start, size, &source))
+				return;
+			if (context.assemble(source, &result))
+				reply = answer(true, Formatter::toHack(result.words));
+			else
+				reply = answer(false, "Line " + to_string(result.diagnostics[0].line) + ": " + result.diagnostics[0].message);
+		}
+		else if (line == "SHUTDOWN")
+		{
+			writeAll(connection, "OK 0\n", 5);
+			stop();
+			return;
+		}
+		else
+			reply = answer(false, "Unknown request: " + line);
+
+		if (!writeAll(connection, reply.data(), reply.size()))
+			return;
+	}
+	if (status == LINE_TOO_LONG) // The rest of the line cannot be told from requests.
+	{
+		string reply = answer(false, "Requests are at most " + to_string(MAX_LINE_LENGTH) + " bytes long");
+		writeAll(connection, reply.data(), reply.size());
+	}
+#endif
+	return;
+}
+
+/**
+ * Assembles the files at paths across the server's threads, as Batch::run does.
+ *
+ * @param paths The asm files.
+ * @param errors Set to the error of each file, or an empty string if it assembled.
+ * @return 0 if every file assembled, 1 otherwise.
+ */
+int AssemblyServer::assembleBatch(const vector<string>& paths, vector<string>* errors)
+{
+	errors->assign(paths.size(), "");
+	vector<size_t> costs(paths.size(), 1);
+	WorkPool pool(threads);
+	vector<Assembler> assemblers(pool.getThreadCount());
+	for (size_t i = 0; i < assemblers.size(); i++)
+	{
+		assemblers[i].setCache(cache);
+		assemblers[i].setThreads(pool.getThreadsPerTask(paths.size())); // Too few files to keep every thread busy; split the files too.
+	}
+	pool.run(costs, [&](size_t task, int thread)
+	{
+		string path = paths[task];
+		if (assemblers[thread].assemble(&path[0]) == 1)
+			(*errors)[task] = assemblers[thread].getError();
+	});
+	for (size_t i = 0; i < errors->size(); i++)
+	{
+		if (!(*errors)[i].empty())
+			return 1;
+	}
+	return 0;
+}
+
+/**
+ * Stops accepting connections; run then hangs up on the rest and returns.
+ */
+void AssemblyServer::stop()
+{
+#ifndef _WIN32
+	lock_guard<mutex> guard(lock);
+	stopping = true;
+	::shutdown(listener, SHUT_RDWR); // Wakes accept on most systems.
+	struct sockaddr_un address; // And a connection wakes it on the rest.
+	int wake = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (wake >= 0 && makeAddress(socketPath, &address) == 0)
+		::connect(wake, (struct sockaddr*)&address, sizeof(address));
+	if (wake >= 0)
+		::close(wake);
+#endif
+	return;
+}
+
+/**
+ * @param threads The number of threads for a batch, or 0 for one per hardware thread.
+ */
+void AssemblyServer::setThreads(int threads)
+{
+	this->threads = threads;
+	return;
+}
+
+/**
+ * @param cache The cache every request looks in first, which must outlive run; NULL for none.
+ */
+void AssemblyServer::setCache(AssemblyCache* cache)
+{
+	this->cache = cache;
+	return;
+}
+
+/**
+ * @return The reason run failed, or an empty string.
+ */
+string AssemblyServer::getError()
+{
+	return error;
+}
+
+/**
+ * @return The socket path from HACK_SOCKET, or else one in /tmp for the user.
+ */
+string AssemblyServer::defaultSocketPath()
+{
+	const char* set = getenv("HACK_SOCKET");
+	if (set != NULL && set[0] != '\0')
+		return set;
+#ifdef _WIN32
+	return "";
+#else
+	return "/tmp/hackAssembler-" + to_string((long)getuid()) + ".sock";
+#endif
+}
+
+// AssemblyClient:
+AssemblyClient::AssemblyClient()
+{
+	connection = -1;
+	start = 0;
+	error = "";
+}
+
+AssemblyClient::~AssemblyClient()
+{
+	close();
+}
+
+/**
+ * Connects to the server at socketPath.
+ *
+ * @return 0 on success, 1 if there is no server; see getError().
+ */
+int AssemblyClient::connect(const string& socketPath)
+{
+	close();
+#ifdef _WIN32
+	error = UNSUPPORTED;
+	return 1;
+#else
+	struct sockaddr_un address;
+	connection = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (connection < 0 || makeAddress(socketPath, &address) == 1
+		|| ::connect(connection, (struct sockaddr*)&address, sizeof(address)) != 0)
+	{
+		error = "Could not connect to " + socketPath + "; start a server with --serve";
+		close();
+		return 1;
+	}
+	signal(SIGPIPE, SIG_IGN); // A server that hangs up only fails the request.
+	return 0;
+#endif
+}
+
+void AssemblyClient::close()
+{
+#ifndef _WIN32
+	if (connection >= 0)
+		::close(connection);
+#endif
+	connection = -1;
+	buffer.clear();
+	start = 0;
+	return;
+}
+
+/**
+ * Has the server assemble the files at paths, all in one batch.
+ * Relative paths are made absolute first, as the server has its own working directory.
+ *
+ * @param paths The asm files.
+ * @param errors Set to the error of each file, or an empty string if it assembled.
+ * @return 0 if the server answered, 1 if the connection failed; see getError().
+ */
+int AssemblyClient::assemble(const vector<string>& paths, vector<string>* errors)
+{
+#ifdef _WIN32
+	error = UNSUPPORTED;
+	return 1;
+#else
+	string request = "BATCH " + to_string(paths.size()) + "\n";
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		char* absolute = realpath(paths[i].c_str(), NULL);
+		string path = (absolute != NULL) ? absolute : paths[i];
+		free(absolute);
+		if (path.find('\n') != string::npos)
+		{
+			error = "Paths may not hold new lines: " + paths[i];
+			return 1;
+		}
+		request += path + "\n";
+	}
+	if (send(request) == 1)
+		return 1;
+
+	errors->assign(paths.size(), "");
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		bool ok;
+		if (readAnswer(&(*errors)[i], &ok) == 1)
+			return 1;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * Has the server assemble source, without any files.
+ *
+ * @param source The asm code.
+ * @param output Set to the hack code.
+ * @return 0 on success, 1 if source is invalid or the connection failed; see getError().
+ */
+int AssemblyClient::assembleSource(string_view source, string* output)
+{
+	string request = "SOURCE " + to_string(source.size()) + "\n";
+	request.append(source.data(), source.size());
+	if (send(request) == 1)
+		return 1;
+	bool ok;
+	if (readAnswer(output, &ok) == 1)
+		return 1;
+	if (!ok)
+	{
+		error = *output;
+		output->clear();
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Stops the server.
+ *
+ * @return 0 on success, 1 if the connection failed; see getError().
+ */
+int AssemblyClient::shutdown()
+{
+	if (send("SHUTDOWN\n") == 1)
+		return 1;
+	string payload;
+	bool ok;
+	return readAnswer(&payload, &ok);
+}
+
+/**
+ * @return 0 on success, 1 if the connection failed.
+ */
+int AssemblyClient::send(const string& data)
+{
+#ifdef _WIN32
+	error = UNSUPPORTED;
+	return 1;
+#else
+	if (connection < 0 || !writeAll(connection, data.data(), data.size()))
+	{
+		error = "Lost the connection to the server";
+		return 1;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * Reads one answer.
+ *
+ * @param payload Set to the hack code of an OK answer, or the message of an ERROR.
+ * @param ok Set to true for OK.
+ * @return 0 on success, 1 if the connection failed.
+ */
+int AssemblyClient::readAnswer(string* payload, bool* ok)
+{
+#ifdef _WIN32
+	error = UNSUPPORTED;
+	return 1;
+#else
+	string line;
+	if (connection < 0 || readLine(connection, &buffer, &start, &line) != LINE_READ)
+	{
+		error = "Lost the connection to the server";
+		return 1;
+	}
+	*ok = (line.compare(0, 3, "OK ") == 0);
+	size_t size = (size_t)atoll(line.c_str() + (*ok ? 3 : 6));
+	if (!readBytes(connection, &buffer, &start, size, payload))
+	{
+		error = "Lost the connection to the server";
+		return 1;
+	}
+	return 0;
+#endif
+}
+
+/**
+ * @return The reason the last call failed.
+ */
+string AssemblyClient::getError()
+{
+	return error;
+}
@@ -0,0 +1,172 @@
+/************************************************************************-
+ *	hackSource.cpp, the implementation of Source from hackASM.h.
+ *  Kept apart from hackASM.cpp as it is the only platform specific code.
+ * 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <io.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+Source::Source()
+{
+	data = "";
+	size = 0;
+	mapping = NULL;
+}
+
+Source::~Source()
+{
+	close();
+}
+
+/**
+ * Opens the file at path. Regular files are mapped; anything else is read into this->buffer.
+ *
+ * @param path The path of the asm file, or "-" for stdin.
+ * @return 0 if the contents are ready, 1 if path could not be opened.
+ */
+int Source::open(const char* path)
+{
+	close();
+	if (string(path) == "-")
+		return readAll(0, 0);
+	
+#ifdef _WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return 1;
+	LARGE_INTEGER fileSize;
+	if (GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+	{
+		HANDLE map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if (map != NULL)
+		{
+			mapping = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+			CloseHandle(map); // The view keeps the mapping alive.
+		}
+		if (mapping != NULL)
+		{
+			CloseHandle(file);
+			data = (const char*)mapping;
+			size = (size_t)fileSize.QuadPart;
+			return 0;
+		}
+	}
+	CloseHandle(file);
+	int fd = ::_open(path, _O_RDONLY | _O_BINARY);
+	if (fd < 0)
+		return 1;
+	int error = readAll(fd, 0);
+	::_close(fd);
+	return error;
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	struct stat info;
+	if (fstat(fd, &info) != 0)
+	{
+		::close(fd);
+		return 1;
+	}
+	if (S_ISREG(info.st_mode) && info.st_size > 0)
+	{
+		void* view = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (view != MAP_FAILED)
+		{
+			madvise(view, (size_t)info.st_size, MADV_SEQUENTIAL); // Every char is read once, front to back.
+			::close(fd);
+			mapping = view;
+			data = (const char*)view;
+			size = (size_t)info.st_size;
+			return 0;
+		}
+	}
+	int error = readAll(fd, S_ISREG(info.st_mode) ? (size_t)info.st_size : 0);
+	::close(fd);
+	return error;
+#endif
+}
+
+/**
+ * Reads everything from fd into this->buffer, with one read call per block.
+ *
+ * @param fd The open file descriptor.
+ * @param sizeHint The expected size, or 0 if unknown.
+ * @return 0 on success, 1 on a read error.
+ */
+int Source::readAll(int fd, size_t sizeHint)
+{
+	const size_t BLOCK_SIZE = 1 << 16;
+	buffer.resize(sizeHint > 0 ? sizeHint + 1 : BLOCK_SIZE); // +1 so a file read whole finds EOF without growing.
+	size_t used = 0;
+	while (true)
+	{
+		if (used == buffer.size())
+			buffer.resize(buffer.size() * 2);
+#ifdef _WIN32
+		int count = ::_read(fd, &buffer[used], (unsigned int)(buffer.size() - used));
+#else
+		ssize_t count = ::read(fd, &buffer[used], buffer.size() - used);
+#endif
+		if (count < 0)
+		{
+			buffer.clear();
+			return 1;
+		}
+		if (count == 0)
+			break;
+		used += (size_t)count;
+	}
+	buffer.resize(used);
+	data = buffer.data();
+	size = used;
+	return 0;
+}
+
+/**
+ * Releases the mapping or buffer. The data pointer is no longer valid afterwards.
+ */
+void Source::close()
+{
+	if (mapping != NULL)
+	{
+#ifdef _WIN32
+		UnmapViewOfFile(mapping);
+#else
+		munmap(mapping, size);
+#endif
+		mapping = NULL;
+	}
+	string().swap(buffer);
+	data = "";
+	size = 0;
+	return;
+}
+
+/**
+ * @return The first char of the contents. Not NULL terminated.
+ */
+const char* Source::getData() const
+{
+	return data;
+}
+
+/**
+ * @return The number of chars in the contents.
+ */
+size_t Source::getSize() const
+{
+	return size;
+}
@@ -0,0 +1,429 @@
+/************************************************************************-
+ *	hackSourceMap.cpp, the implementation of SourceMap from hackASM.h.
+ *  Keeps where every address, label and variable came from, so tools need not parse the source again.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <algorithm>
+#include <cstring>
+
+static const size_t ENTRY_SIZE = 12; // Name offset, name length, value.
+
+/**
+ * @return The little-endian uint32 at bytes.
+ */
+static uint32_t readUint32(const unsigned char* bytes)
+{
+	return bytes[0] | bytes[1] << 8 | bytes[2] << 16 | (uint32_t)bytes[3] << 24;
+}
+
+/**
+ * Writes value at bytes, little-endian.
+ */
+static void writeUint32(unsigned char* bytes, uint32_t value)
+{
+	for (int b = 0; b < 4; b++)
+		bytes[b] = (unsigned char)(value >> (8 * b));
+	return;
+}
+
+SourceMap::SourceMap()
+{
+	external = NULL;
+	wordCount = 0;
+	labelCount = 0;
+	variableCount = 0;
+	nameBytes = 0;
+}
+
+const unsigned char* SourceMap::base() const
+{
+	return (const unsigned char*)((external != NULL) ? external : data.data());
+}
+
+uint32_t SourceMap::number(size_t offset) const
+{
+	return readUint32(base() + offset);
+}
+
+size_t SourceMap::linesAt() const
+{
+	return HEADER_SIZE;
+}
+
+size_t SourceMap::labelsAt() const
+{
+	return linesAt() + wordCount * 4;
+}
+
+size_t SourceMap::variablesAt() const
+{
+	return labelsAt() + labelCount * (ENTRY_SIZE + 4);
+}
+
+/**
+ * @param table The offset of a label or variable table.
+ * @param index The entry.
+ * @return The entry's name.
+ */
+string_view SourceMap::entryName(size_t table, size_t index) const
+{
+	size_t namesAt = variablesAt() + variableCount * (ENTRY_SIZE + 4);
+	size_t entry = table + index * ENTRY_SIZE;
+	return string_view((const char*)base() + namesAt + number(entry), number(entry + 4));
+}
+
+/**
+ * Binary searches a table sorted by name.
+ *
+ * @return The value of the entry named name, or SymbolTable::NOT_FOUND.
+ */
+int SourceMap::find(size_t table, size_t count, const char* name, int length) const
+{
+	string_view key(name, length);
+	size_t low = 0;
+	size_t high = count;
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if (entryName(table, middle) < key)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < count && entryName(table, low) == key)
+		return (int)number(table + low * ENTRY_SIZE + 8);
+	return SymbolTable::NOT_FOUND;
+}
+
+/**
+ * Binary searches the indexes after a table, which are sorted by value.
+ *
+ * @return The first entry with value, or -1.
+ */
+int SourceMap::findAt(size_t table, size_t count, int value) const
+{
+	size_t order = table + count * ENTRY_SIZE;
+	size_t low = 0;
+	size_t high = count;
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if ((int)number(table + number(order + middle * 4) * ENTRY_SIZE + 8) < value)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < count && (int)number(table + number(order + low * 4) * ENTRY_SIZE + 8) == value)
+		return (int)number(order + low * 4);
+	return -1;
+}
+
+/**
+ * Builds the map of a program Resolver has resolved.
+ *
+ * @param program Resolver's Program.
+ * @param symbols Resolver's symbols: the built-in symbols, then labelCount labels, then the variables.
+ * @param labelCount The number of labels, Resolver::getLabelCount.
+ */
+void SourceMap::build(const Program& program, const SymbolTable& symbols, int labelCount)
+{
+	int firstLabel = SymbolTable::predefined().size();
+	int firstVariable = firstLabel + labelCount;
+	external = NULL;
+	wordCount = program.size();
+	this->labelCount = labelCount;
+	variableCount = symbols.size() - firstVariable;
+	nameBytes = 0;
+	for (int id = firstLabel; id < symbols.size(); id++)
+		nameBytes += symbols.getName(id).size();
+	data.assign(variablesAt() + variableCount * (ENTRY_SIZE + 4) + nameBytes, '\0');
+	unsigned char* bytes = (unsigned char*)&data[0];
+	memcpy(bytes, "HMAP", 4);
+	writeUint32(bytes + 4, 1 | (uint32_t)HEADER_SIZE << 16); // Version and header size.
+	writeUint32(bytes + 8, (uint32_t)wordCount);
+	writeUint32(bytes + 12, (uint32_t)labelCount);
+	writeUint32(bytes + 16, (uint32_t)variableCount);
+	writeUint32(bytes + 20, (uint32_t)nameBytes);
+	for (size_t address = 0; address < wordCount; address++)
+		writeUint32(bytes + linesAt() + address * 4, (uint32_t)program.lines[address]);
+
+	// Each table holds the symbols from first to end, sorted by name; the indexes after it sort them by value.
+	// Resolver numbers both labels and variables in the order it adds them, so that order is usually already by value.
+	size_t nameOffset = 0;
+	size_t namesAt = data.size() - nameBytes;
+	auto writeTable = [&](size_t table, int first, int end)
+	{
+		// Sorted on the first 8 bytes of each name, big-endian, so most compares never leave the array.
+		vector<string_view> names;
+		vector<pair<uint64_t, int>> keys;
+		for (int id = first; id < end; id++)
+		{
+			string_view name = symbols.getName(id);
+			uint64_t key = 0;
+			for (size_t b = 0; b < 8; b++)
+				key = key << 8 | ((b < name.size()) ? (unsigned char)name[b] : 0);
+			names.push_back(name);
+			keys.push_back(make_pair(key, id - first));
+		}
+		sort(keys.begin(), keys.end(), [&](const pair<uint64_t, int>& x, const pair<uint64_t, int>& y)
+		{
+			return (x.first != y.first) ? x.first < y.first : names[x.second] < names[y.second];
+		});
+		vector<int> byName(keys.size());
+		for (size_t i = 0; i < keys.size(); i++)
+			byName[i] = keys[i].second;
+		vector<uint32_t> index(byName.size()); // Of each symbol in the table.
+		for (size_t i = 0; i < byName.size(); i++)
+		{
+			string_view name = names[byName[i]];
+			writeUint32(bytes + table + i * ENTRY_SIZE, (uint32_t)nameOffset);
+			writeUint32(bytes + table + i * ENTRY_SIZE + 4, (uint32_t)name.size());
+			writeUint32(bytes + table + i * ENTRY_SIZE + 8, (uint32_t)symbols.getValue(first + byName[i]));
+			memcpy(bytes + namesAt + nameOffset, name.data(), name.size());
+			nameOffset += name.size();
+			index[byName[i]] = (uint32_t)i;
+		}
+		vector<int> byValue(index.size());
+		for (size_t i = 0; i < byValue.size(); i++)
+			byValue[i] = (int)i;
+		auto before = [&](int x, int y) { return symbols.getValue(first + x) < symbols.getValue(first + y); };
+		if (!is_sorted(byValue.begin(), byValue.end(), before))
+			stable_sort(byValue.begin(), byValue.end(), before);
+		for (size_t i = 0; i < byValue.size(); i++)
+			writeUint32(bytes + table + index.size() * ENTRY_SIZE + i * 4, index[byValue[i]]);
+	};
+	writeTable(labelsAt(), firstLabel, firstVariable);
+	writeTable(variablesAt(), firstVariable, symbols.size());
+	return;
+}
+
+/**
+ * Checks a .hmap file and reads it into this map.
+ *
+ * @param data The file contents.
+ * @param size The number of bytes in data.
+ * @param inPlace true to search data where it lies, such as a mapped file, which must then outlive the map;
+ *                false to copy it.
+ * @return 0 on success, 1 if data is not a valid source map.
+ */
+int SourceMap::read(const char* data, size_t size, bool inPlace)
+{
+	const unsigned char* bytes = (const unsigned char*)data;
+	*this = SourceMap();
+	if (size < HEADER_SIZE || memcmp(data, "HMAP", 4) != 0 || readUint32(bytes + 4) != (1 | (uint32_t)HEADER_SIZE << 16))
+		return 1;
+	size_t words = readUint32(bytes + 8);
+	size_t labels = readUint32(bytes + 12);
+	size_t variables = readUint32(bytes + 16);
+	size_t names = readUint32(bytes + 20);
+	// Each part in turn must fit in what is left, which also keeps the offsets from overflowing.
+	size_t left = size - HEADER_SIZE;
+	if (left / 4 < words)
+		return 1;
+	left -= words * 4;
+	if (left / (ENTRY_SIZE + 4) < labels)
+		return 1;
+	left -= labels * (ENTRY_SIZE + 4);
+	if (left / (ENTRY_SIZE + 4) < variables)
+		return 1;
+	left -= variables * (ENTRY_SIZE + 4);
+	if (left != names)
+		return 1;
+
+	external = data;
+	wordCount = words;
+	labelCount = labels;
+	variableCount = variables;
+	nameBytes = names;
+	size_t tables[2][2] = {{labelsAt(), labelCount}, {variablesAt(), variableCount}};
+	for (int t = 0; t < 2; t++)
+	{
+		for (size_t i = 0; i < tables[t][1]; i++)
+		{
+			size_t entry = tables[t][0] + i * ENTRY_SIZE;
+			if (number(entry) > nameBytes || number(entry + 4) > nameBytes - number(entry)
+				|| number(tables[t][0] + tables[t][1] * ENTRY_SIZE + i * 4) >= tables[t][1])
+			{
+				*this = SourceMap();
+				return 1;
+			}
+		}
+	}
+	if (!inPlace)
+	{
+		this->data.assign(data, size);
+		external = NULL;
+	}
+	return 0;
+}
+
+/**
+ * @return The .hmap file.
+ */
+const char* SourceMap::getData() const
+{
+	return (const char*)base();
+}
+
+size_t SourceMap::getSize() const
+{
+	return (wordCount == 0 && labelCount == 0 && variableCount == 0 && external == NULL && data.empty()) ? 0
+		: variablesAt() + variableCount * (ENTRY_SIZE + 4) + nameBytes;
+}
+
+/**
+ * @param address A ROM address.
+ * @return The source line of the command at address, or 0 if there is none.
+ */
+int SourceMap::getLine(int address) const
+{
+	if (address < 0 || (size_t)address >= wordCount)
+		return 0;
+	return (int)number(linesAt() + (size_t)address * 4);
+}
+
+/**
+ * @param line A source line.
+ * @return The ROM address of the first command on line or after it, or SymbolTable::NOT_FOUND.
+ */
+int SourceMap::findAddress(int line) const
+{
+	size_t low = 0;
+	size_t high = wordCount;
+	while (low < high)
+	{
+		size_t middle = low + (high - low) / 2;
+		if ((int)number(linesAt() + middle * 4) < line)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	return (low < wordCount) ? (int)low : SymbolTable::NOT_FOUND;
+}
+
+/**
+ * @return The ROM address of the label name, or SymbolTable::NOT_FOUND.
+ */
+int SourceMap::findLabel(const char* name, int length) const
+{
+	return find(labelsAt(), labelCount, name, length);
+}
+
+/**
+ * @return The register of the variable name, or SymbolTable::NOT_FOUND.
+ */
+int SourceMap::findVariable(const char* name, int length) const
+{
+	return find(variablesAt(), variableCount, name, length);
+}
+
+/**
+ * @param address A ROM address.
+ * @return The first label declared at address, or an empty string.
+ */
+string_view SourceMap::labelAt(int address) const
+{
+	int index = findAt(labelsAt(), labelCount, address);
+	return (index < 0) ? string_view() : entryName(labelsAt(), index);
+}
+
+/**
+ * @param address A register.
+ * @return The variable in it, or an empty string.
+ */
+string_view SourceMap::variableAt(int address) const
+{
+	int index = findAt(variablesAt(), variableCount, address);
+	return (index < 0) ? string_view() : entryName(variablesAt(), index);
+}
+
+size_t SourceMap::getWordCount() const
+{
+	return wordCount;
+}
+
+size_t SourceMap::getLabelCount() const
+{
+	return labelCount;
+}
+
+size_t SourceMap::getVariableCount() const
+{
+	return variableCount;
+}
+
+/**
+ * Writes a listing for people: every address with its word, line and source text, with the labels declared
+ * where they point, then the labels by address and the variables by register.
+ *
+ * @param words The hack code the map is of.
+ * @param source The asm code the map is of.
+ * @return The listing.
+ */
+string SourceMap::toListing(const vector<uint16_t>& words, string_view source) const
+{
+	vector<size_t> lineStarts(1, 0);
+	for (size_t i = 0; i < source.size(); i++)
+	{
+		const char* newLine = (const char*)memchr(source.data() + i, '\n', source.size() - i);
+		if (newLine == NULL)
+			break;
+		i = newLine - source.data();
+		lineStarts.push_back(i + 1);
+	}
+	auto pad = [](string* output, const string& text, size_t width)
+	{
+		if (text.size() < width)
+			output->append(width - text.size(), ' ');
+		output->append(text);
+	};
+
+	string output = "Address  Word              Line  Source\n";
+	size_t order = labelsAt() + labelCount * ENTRY_SIZE;
+	size_t next = 0; // Labels are declared in address order.
+	for (size_t address = 0; address <= wordCount; address++)
+	{
+		for (; next < labelCount && number(labelsAt() + number(order + next * 4) * ENTRY_SIZE + 8) <= address; next++)
+			output += "                                  (" + string(entryName(labelsAt(), number(order + next * 4))) + ")\n";
+		if (address == wordCount)
+			break;
+		int line = getLine((int)address);
+		string_view text;
+		if (line >= 1 && (size_t)line <= lineStarts.size())
+		{
+			size_t start = lineStarts[line - 1];
+			size_t end = ((size_t)line < lineStarts.size()) ? lineStarts[line] - 1 : source.size();
+			while (start < end && Resolver::isBlank(source[start]))
+				start++;
+			while (end > start && (source[end - 1] == '\r' || Resolver::isBlank(source[end - 1])))
+				end--;
+			text = source.substr(start, end - start);
+		}
+		pad(&output, to_string(address), 7);
+		output += "  ";
+		for (int bit = 15; bit >= 0; bit--)
+			output += (address < words.size()) ? (char)('0' + ((words[address] >> bit) & 1)) : ' ';
+		pad(&output, to_string(line), 6);
+		output += "  ";
+		output.append(text.data(), text.size());
+		output += "\n";
+	}
+
+	const char* titles[] = {"\nLabels\n", "\nVariables\n"};
+	size_t tables[2][2] = {{labelsAt(), labelCount}, {variablesAt(), variableCount}};
+	for (int t = 0; t < 2; t++)
+	{
+		output += titles[t];
+		size_t tableOrder = tables[t][0] + tables[t][1] * ENTRY_SIZE;
+		for (size_t i = 0; i < tables[t][1]; i++)
+		{
+			size_t index = number(tableOrder + i * 4);
+			pad(&output, to_string(number(tables[t][0] + index * ENTRY_SIZE + 8)), 7);
+			output += "  " + string(entryName(tables[t][0], index)) + "\n";
+		}
+	}
+	return output;
+}
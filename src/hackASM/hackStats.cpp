@@ -0,0 +1,201 @@
+/************************************************************************-
+ *	hackStats.cpp, the implementation of AssemblyStats and AllocationCounter from hackASM.h.
+ *  Kept apart from hackASM.cpp as it replaces the global operator new and delete, in builds with
+ *  HACK_COUNT_ALLOCATIONS defined, and reads the peak memory in a platform specific way.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+#include <chrono>
+#include <cstdio>
+#include <new>
+
+#ifdef _WIN32
+#define PSAPI_VERSION 2 // GetProcessMemoryInfo from kernel32, so no psapi library is needed.
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+// Each thread counts its own allocations, so files assembled at once on several threads are told apart.
+static thread_local int countingOn = 0;
+static thread_local long long allocationCount = 0;
+static thread_local long long allocationBytes = 0;
+
+#ifdef HACK_COUNT_ALLOCATIONS
+// Only built in when asked for; then each allocation, counted or not, reads countingOn.
+void* operator new(size_t size)
+{
+	if (countingOn > 0)
+	{
+		allocationCount++;
+		allocationBytes += (long long)size;
+	}
+	void* memory = malloc(size == 0 ? 1 : size);
+	if (memory == NULL)
+		throw bad_alloc();
+	return memory;
+}
+
+void operator delete(void* memory) noexcept
+{
+	free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	free(memory);
+}
+#endif
+
+/**
+ * Starts counting the calling thread's allocations from zero. Calls may nest on one thread;
+ * counting goes on until every start has its stop.
+ */
+void AllocationCounter::start()
+{
+	if (countingOn++ == 0)
+	{
+		allocationCount = 0;
+		allocationBytes = 0;
+	}
+	return;
+}
+
+void AllocationCounter::stop()
+{
+	countingOn--;
+	return;
+}
+
+/**
+ * @return true if this build counts allocations: it was compiled with HACK_COUNT_ALLOCATIONS defined.
+ */
+bool AllocationCounter::isCounting()
+{
+#ifdef HACK_COUNT_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * @return The number of allocations on the calling thread since its first start, or NOT_COUNTED.
+ */
+long long AllocationCounter::getCount()
+{
+	return isCounting() ? allocationCount : NOT_COUNTED;
+}
+
+/**
+ * @return The bytes asked for on the calling thread since its first start, or NOT_COUNTED. Frees are not taken off.
+ */
+long long AllocationCounter::getBytes()
+{
+	return isCounting() ? allocationBytes : NOT_COUNTED;
+}
+
+AssemblyStats::AssemblyStats()
+{
+	loadSeconds = 0;
+	scanSeconds = 0;
+	resolveSeconds = 0;
+	encodeSeconds = 0;
+	formatSeconds = 0;
+	writeSeconds = 0;
+	bytes = 0;
+	lines = 0;
+	commands = 0;
+	removed = 0;
+	labels = 0;
+	variables = 0;
+	symbols = 0;
+	lookups = 0;
+	probes = 0;
+	allocations = 0;
+	allocatedBytes = 0;
+	peakRSS = 0;
+	cacheHit = false;
+}
+
+/**
+ * @return count for JSON, or null if it is AllocationCounter::NOT_COUNTED.
+ */
+static string counted(long long count)
+{
+	return (count == AllocationCounter::NOT_COUNTED) ? "null" : to_string(count);
+}
+
+/**
+ * Writes the stats as one line of JSON.
+ *
+ * @param path The file the stats are for.
+ * @return The JSON object, without a new line.
+ */
+string AssemblyStats::toJSON(const string& path) const
+{
+	string json = "{\"file\":\"";
+	for (size_t i = 0; i < path.size(); i++)
+	{
+		unsigned char c = (unsigned char)path[i];
+		if (c == '"' || c == '\\')
+		{
+			json += '\\';
+			json += (char)c;
+		}
+		else if (c < 0x20)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+			json += escaped;
+		}
+		else
+			json += (char)c;
+	}
+
+	char buffer[1024];
+	snprintf(buffer, sizeof(buffer),
+		"\",\"seconds\":{\"load\":%.6f,\"scan\":%.6f,\"resolve\":%.6f,\"encode\":%.6f,\"format\":%.6f,\"write\":%.6f},"
+		"\"bytes\":%llu,\"lines\":%llu,\"commands\":%llu,\"removed\":%llu,"
+		"\"labels\":%d,\"variables\":%d,\"symbols\":%d,\"lookups\":%lld,\"probes\":%lld,"
+		"\"allocations\":%s,\"allocatedBytes\":%s,\"peakRSS\":%llu,\"cacheHit\":%s}",
+		loadSeconds, scanSeconds, resolveSeconds, encodeSeconds, formatSeconds, writeSeconds,
+		(unsigned long long)bytes, (unsigned long long)lines, (unsigned long long)commands, (unsigned long long)removed,
+		labels, variables, symbols, lookups, probes,
+		counted(allocations).c_str(), counted(allocatedBytes).c_str(), (unsigned long long)peakRSS, cacheHit ? "true" : "false");
+	json += buffer;
+	return json;
+}
+
+/**
+ * @return Seconds since some fixed point, for timing stages.
+ */
+double AssemblyStats::now()
+{
+	return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @return The most memory the process has had resident so far, in bytes, or 0 if unknown.
+ */
+size_t AssemblyStats::currentPeakRSS()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return counters.PeakWorkingSetSize;
+	return 0;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+#ifdef __APPLE__
+	return (size_t)usage.ru_maxrss; // Already in bytes.
+#else
+	return (size_t)usage.ru_maxrss * 1024; // In KB.
+#endif
+#endif
+}
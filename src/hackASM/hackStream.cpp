@@ -0,0 +1,290 @@
+/************************************************************************-
+ *	hackStream.cpp, the implementation of StreamAssembler from hackASM.h.
+ *  Assembles asm code from a pipe as it arrives, without holding the whole source.
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+#include "hackASM.h"
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+StreamAssembler::StreamAssembler()
+{
+	flushed = 0;
+	ready = 0;
+	wordCount = 0;
+	maxHeld = 0;
+	freeFixup = -1;
+	lineBase = 0;
+	output = NULL;
+	error = "";
+	errorLine = 0;
+}
+
+/**
+ * Reads asm code from input until it ends, writing the .hack text to output as the words are settled.
+ * If a command is invalid, the words before it may already have been written.
+ *
+ * @param input The file descriptor to read, such as 0 for stdin.
+ * @param output Where the .hack text goes.
+ * @return 0 on success, 1 if a command is invalid or input could not be read; see getError().
+ */
+int StreamAssembler::assemble(int input, FILE* output)
+{
+	symbols = SymbolTable::predefined();
+	unresolved = SymbolTable();
+	fixupHeads.clear();
+	fixups.clear();
+	freeFixup = -1;
+	held.clear();
+	settled.clear();
+	flushed = 0;
+	ready = 0;
+	wordCount = 0;
+	maxHeld = 0;
+	lineBase = 0;
+	this->output = output;
+	error = "";
+	errorLine = 0;
+
+	string buffer; // The text after the last whole line read so far, and the block being read.
+	bool ended = false;
+	while (!ended)
+	{
+		size_t used = buffer.size();
+		buffer.resize(used + READ_SIZE);
+#ifdef _WIN32
+		int count = ::_read(input, &buffer[used], (unsigned int)READ_SIZE);
+#else
+		ssize_t count = ::read(input, &buffer[used], READ_SIZE);
+#endif
+		if (count < 0)
+		{
+			error = "Could not read the input";
+			return 1;
+		}
+		buffer.resize(used + (size_t)count);
+		ended = (count == 0);
+
+		size_t end = ended ? buffer.size() : buffer.rfind('\n') + 1; // Only whole lines, until the end.
+		if (!ended && end == 0) // No new line yet; read more.
+			continue;
+		if (encodeBlock(buffer.data(), end) == 1)
+			return 1;
+		buffer.erase(0, end);
+		if (flush(false) == 1)
+			return 1;
+	}
+
+	// Every label is declared by now, so what is left are variables, in first use order.
+	int varCounter = 0;
+	for (int id = 0; id < unresolved.size(); id++)
+	{
+		if (unresolved.getValue(id) != SymbolTable::NOT_FOUND)
+			continue;
+		string_view name = unresolved.getName(id);
+		int value = Resolver::VAR_ASSIGN_ADD_START + varCounter++;
+		symbols.add(name.data(), (int)name.size(), value);
+		settle(id, value);
+	}
+	return flush(true);
+}
+
+/**
+ * Encodes the commands in source and adds its labels. source holds whole lines only.
+ *
+ * @param source The asm code.
+ * @param size The number of chars in source.
+ * @return 0 on success, 1 if a command is invalid.
+ */
+int StreamAssembler::encodeBlock(const char* source, size_t size)
+{
+	vector<Instruction> commands;
+	vector<Label> labels;
+	string scratch;
+	int length;
+	int newLines = Resolver::scan(source, 0, size, &commands, &labels);
+
+	// Labels first: they only depend on the number of commands before them, and settle earlier uses.
+	for (size_t i = 0; i < labels.size(); i++)
+	{
+		const char* name = Resolver::compact(source + labels[i].start, labels[i].length, &scratch, &length);
+		if (Resolver::isNumber(name, length) || symbols.find(name, length) != SymbolTable::NOT_FOUND) // The first declaration wins.
+			continue;
+		int address = (int)wordCount + labels[i].address;
+		symbols.add(name, length, address);
+		int id = unresolved.find(name, length);
+		if (id != SymbolTable::NOT_FOUND)
+			settle(id, address);
+	}
+
+	for (size_t n = 0; n < commands.size(); n++)
+	{
+		const Instruction& command = commands[n];
+		const char* text = source + command.start;
+		uint16_t word = 0;
+		bool known = true;
+		if (command.kind == Instruction::A_COMMAND)
+		{
+			const char* name = Resolver::compact(text + 1, command.length - 1, &scratch, &length);
+			int id;
+			if (Resolver::isNumber(name, length))
+				word = (uint16_t)Resolver::parseNumber(name, length);
+			else if ((id = symbols.find(name, length)) != SymbolTable::NOT_FOUND)
+				word = (uint16_t)(symbols.getValue(id) & 0x7FFF);
+			else
+			{
+				id = unresolved.find(name, length);
+				if (id == SymbolTable::NOT_FOUND)
+				{
+					id = unresolved.add(name, length, SymbolTable::NOT_FOUND);
+					fixupHeads.push_back(-1);
+				}
+				Fixup fixup = {wordCount + n, fixupHeads[id]};
+				if (freeFixup == -1)
+				{
+					fixupHeads[id] = (int)fixups.size();
+					fixups.push_back(fixup);
+				}
+				else
+				{
+					fixupHeads[id] = freeFixup;
+					freeFixup = fixups[freeFixup].next;
+					fixups[fixupHeads[id]] = fixup;
+				}
+				known = false;
+			}
+		}
+		else
+		{
+			const char* code = Resolver::compact(text, command.length, &scratch, &length);
+			int encoded = Interpreter::encodeC(code, length);
+			if (encoded == Interpreter::CODE_ERROR)
+			{
+				error = "Invalid command: " + string(code, length);
+				errorLine = lineBase + command.line;
+				return 1;
+			}
+			word = (uint16_t)encoded;
+		}
+		held.push_back(word);
+		settled.push_back(known ? 1 : 0);
+	}
+	wordCount += commands.size();
+	lineBase += newLines;
+	if (held.size() > maxHeld)
+		maxHeld = held.size();
+	return 0;
+}
+
+/**
+ * Gives an unresolved symbol its value and patches every word that uses it.
+ * Its fixups then go on the free list, so a long stream only holds as many as are waiting at once.
+ *
+ * @param id The symbol's id in this->unresolved.
+ * @param value The ROM address or register.
+ */
+void StreamAssembler::settle(int id, int value)
+{
+	unresolved.setValue(id, value);
+	int last = -1;
+	for (int f = fixupHeads[id]; f != -1; f = fixups[f].next)
+	{
+		held[fixups[f].word - flushed] = (uint16_t)(value & 0x7FFF);
+		settled[fixups[f].word - flushed] = 1;
+		last = f;
+	}
+	if (last != -1)
+	{
+		fixups[last].next = freeFixup;
+		freeFixup = fixupHeads[id];
+	}
+	fixupHeads[id] = -1;
+	return;
+}
+
+/**
+ * Writes the settled words at the front of held, once there are FLUSH_WORDS of them.
+ *
+ * @param all true to write every settled word, however few.
+ * @return 0 on success, 1 if the output could not be written.
+ */
+int StreamAssembler::flush(bool all)
+{
+	while (ready < settled.size() && settled[ready]) // Carries on from the last call, so stalled words are not rescanned.
+		ready++;
+	if (ready == 0 || (!all && ready < FLUSH_WORDS))
+		return 0;
+
+	vector<uint16_t> block(held.begin(), held.begin() + ready);
+	size_t offset = (flushed > 0) ? 1 : 0; // The new line between the last block and this one.
+	text.resize(offset + Formatter::hackSize(ready));
+	if (offset == 1)
+		text[0] = '\n';
+	Formatter::writeHack(block.data(), ready, &text[offset]);
+	if (fwrite(text.data(), 1, text.size(), output) != text.size())
+	{
+		error = "Could not write the output";
+		return 1;
+	}
+	held.erase(held.begin(), held.begin() + ready);
+	settled.erase(settled.begin(), settled.begin() + ready);
+	flushed += ready;
+	ready = 0;
+	if (all)
+		fflush(output);
+	return 0;
+}
+
+/**
+ * @return The reason assemble failed, or an empty string.
+ */
+string StreamAssembler::getError()
+{
+	return error;
+}
+
+/**
+ * @return The line number of the invalid command that made assemble fail.
+ */
+int StreamAssembler::getErrorLine()
+{
+	return errorLine;
+}
+
+/**
+ * @return The number of commands assembled.
+ */
+size_t StreamAssembler::getWordCount()
+{
+	return wordCount;
+}
+
+/**
+ * @return The most words that were held at once, waiting for a symbol.
+ */
+size_t StreamAssembler::getMaxHeldWords()
+{
+	return maxHeld;
+}
+
+/**
+ * @return The most fixups that were waiting for a symbol at once; settled ones are reused.
+ */
+size_t StreamAssembler::getMaxFixups()
+{
+	return fixups.size();
+}
+
+/**
+ * @return The built-in symbols, labels and variables of the last assembled input.
+ */
+const SymbolTable& StreamAssembler::getSymbols()
+{
+	return symbols;
+}
@@ -1 +1 @@
-hackAssembler.exe C:\Users\Night_Blader\Desktop\nand2tetris\nand2tetris\projects\06\pong\PongL.asm
+hackAssembler.exe C:\Users\Night_Blader\Desktop\nand2tetris\nand2tetris\projects\06\pong\PongL.asm
@@ -0,0 +1,844 @@
+/************************************************************************-
+ *	hackBench, times every stage of the assembler on generated programs.
+ *  
+ *	The generator is deterministic, so numbers from different builds can be compared.
+ *	Workloads:
+ *		comments   Mostly comments, indentation and empty lines, as a compiler writes.
+ *		labels     A label declaration and jump every few commands.
+ *		variables  Thousands of distinct variables.
+ *		ccode      Almost only C commands.
+ *		mixed      What the VM translator writes: a bit of everything.
+ *		stream     Forward jumps through StreamAssembler, whose fixups and held words must stay bounded.
+ *		execute    Not a workload to assemble: times the built-in executor on a loop, with and without profiling,
+ *		           and checks a program runs the same with -O.
+ *
+ *	Usage: hackBench [size, e.g. 512K, 16M or 1G] [workload] [repeats]
+ *
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+
+// Compile: g++ -O2 -DHACK_COUNT_ALLOCATIONS hackBench.cpp hackASM/hackASM.cpp hackASM/hackSource.cpp hackASM/hackBatch.cpp hackASM/hackParallel.cpp hackASM/hackScan.cpp hackASM/hackStats.cpp hackASM/hackCache.cpp hackASM/hackServer.cpp hackASM/hackStream.cpp hackASM/hackIncremental.cpp hackASM/hackObject.cpp hackASM/hackOptimize.cpp hackASM/hackExecute.cpp hackASM/hackDisassemble.cpp hackASM/hackSourceMap.cpp -o hackBench -std=c++17 -pthread -static-libgcc -static-libstdc++
+
+#include "hackASM/hackASM.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdio>
+
+/**
+ * Writes asm programs of a given size and kind. The same seed always gives the same program.
+ */
+class ProgramGenerator
+{
+private:
+	uint64_t state;
+	
+	uint32_t next()
+	{
+		state ^= state << 13; // xorshift64
+		state ^= state >> 7;
+		state ^= state << 17;
+		return (uint32_t)(state >> 32);
+	}
+	
+	const char* pick(const char* const* list, int count)
+	{
+		return list[next() % count];
+	}
+	
+	void cCommand(string* out)
+	{
+		static const char* const COMPS[] = {"0", "1", "-1", "D", "A", "!D", "!A", "-D", "-A", "D+1", "A+1", "D-1", "A-1", 
+			"D+A", "D-A", "A-D", "D&A", "D|A", "M", "!M", "-M", "M+1", "M-1", "D+M", "D-M", "M-D", "D&M", "D|M"};
+		static const char* const DESTS[] = {"M", "D", "MD", "A", "AM", "AD", "AMD"};
+		static const char* const JUMPS[] = {"JGT", "JEQ", "JGE", "JLT", "JNE", "JLE", "JMP"};
+		if (next() % 8 == 0)
+		{
+			out->append(pick(COMPS, 28));
+			out->append(";");
+			out->append(pick(JUMPS, 7));
+		}
+		else
+		{
+			out->append(pick(DESTS, 7));
+			out->append("=");
+			out->append(pick(COMPS, 28));
+		}
+		return;
+	}
+	
+	void indent(string* out)
+	{
+		out->append(next() % 2 ? "    " : "\t");
+	}
+	
+public:
+	ProgramGenerator(uint64_t seed)
+	{
+		state = seed * 2654435761u + 1;
+	}
+	
+	/**
+	 * @param workload One of comments, labels, variables, ccode or mixed.
+	 * @param size The size of the program to write, in bytes; it ends at the first line past it.
+	 * @return The asm code, or an empty string if workload is unknown.
+	 */
+	string generate(const string& workload, size_t size)
+	{
+		string out;
+		out.reserve(size + 128);
+		int label = 0;
+		while (out.size() < size)
+		{
+			uint32_t roll = next() % 100;
+			if (workload == "comments")
+			{
+				if (roll < 55)
+				{
+					indent(&out);
+					out.append("// push constant ");
+					out.append(to_string(next() % 1000));
+					out.append(" onto the stack, then move on to the next step");
+				}
+				else if (roll < 70)
+					out.append("");
+				else if (roll < 85)
+				{
+					indent(&out);
+					out.append("@SP // stack pointer");
+				}
+				else
+				{
+					indent(&out);
+					cCommand(&out);
+					out.append("    // update");
+				}
+			}
+			else if (workload == "labels")
+			{
+				if (roll < 30)
+				{
+					out.append("(L");
+					out.append(to_string(label++));
+					out.append(")");
+				}
+				else if (roll < 65) // Jump to a nearby label, declared before or after.
+				{
+					int target = label + (int)(next() % 64) - 32;
+					out.append("@L");
+					out.append(to_string(target < 0 ? 0 : target));
+				}
+				else
+					out.append("0;JMP");
+			}
+			else if (workload == "variables")
+			{
+				if (roll < 50)
+				{
+					out.append("@var.");
+					out.append(to_string(next() % 20000));
+				}
+				else
+					cCommand(&out);
+			}
+			else if (workload == "ccode")
+			{
+				if (roll < 10)
+				{
+					out.append("@");
+					out.append(to_string(next() % 32768));
+				}
+				else
+					cCommand(&out);
+			}
+			else if (workload == "mixed")
+			{
+				if (roll < 15)
+				{
+					out.append("// ");
+					out.append(to_string(next()));
+				}
+				else if (roll < 20)
+				{
+					out.append("(Main.loop$");
+					out.append(to_string(label++));
+					out.append(")");
+				}
+				else if (roll < 50)
+				{
+					indent(&out);
+					static const char* const SYMBOLS[] = {"SP", "LCL", "ARG", "THIS", "THAT", "R13", "R14", "SCREEN"};
+					out.append("@");
+					if (roll < 30)
+						out.append(pick(SYMBOLS, 8));
+					else if (roll < 40)
+						out.append(to_string(next() % 256));
+					else
+						out.append("Main.static." + to_string(next() % 500));
+				}
+				else
+				{
+					indent(&out);
+					cCommand(&out);
+				}
+			}
+			else
+				return "";
+			out.append("\n");
+		}
+		return out;
+	}
+	
+	/**
+	 * Writes counted loops full of instructions -O leaves out, such as loads of the address already in A,
+	 * whose jumps only go to labels. The program ends in a halt loop, so it may be run to the end.
+	 * Registers are added to rather than overwritten, so every instruction that runs shows in the RAM at the end.
+	 *
+	 * @param count The number of loops.
+	 * @return The asm code.
+	 */
+	string loops(int count)
+	{
+		string out;
+		for (int i = 0; i < count; i++)
+		{
+			string loop = "B" + to_string(i);
+			out += "@" + to_string(1 + next() % 40) + "\nD=A\n@c" + to_string(i) + "\nM=D\n(" + loop + ")\n";
+			int steps = 4 + next() % 8;
+			for (int j = 0; j < steps; j++)
+			{
+				string x = "@x" + to_string(next() % 8) + "\n";
+				string y = "@x" + to_string(next() % 8) + "\n";
+				switch (next() % 6)
+				{
+				case 0:
+					out += x + "D=M\n" + y + "M=D+M\n";
+					break;
+				case 1: // The second load is A already.
+					out += x + "M=M+1\n" + x + "D=M\n";
+					break;
+				case 2: // Stores back what was just read.
+					out += x + "D=M\n" + x + "M=D\n";
+					break;
+				case 3: // Jumps over a step, to a label.
+					out += "@" + loop + ".skip" + to_string(j) + "\nD;JLT\n" + x + "M=M-1\n(" + loop + ".skip" + to_string(j) + ")\n";
+					break;
+				case 4: // The first load is overwritten before use.
+					out += y + x + "M=D+M\n";
+					break;
+				default:
+					out += "D=D-1\n" + x + "M=D+M\n";
+					break;
+				}
+			}
+			out += "@c" + to_string(i) + "\nMD=M-1\n@" + loop + "\nD;JGT\n";
+		}
+		out += "(END)\n@END\n0;JMP\n";
+		return out;
+	}
+};
+
+/**
+ * Times fn repeats times.
+ *
+ * @return The fastest run, in seconds.
+ */
+double timeBest(int repeats, const function<void()>& fn)
+{
+	double best = 1e30;
+	for (int i = 0; i < repeats; i++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		fn();
+		double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		if (seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+/**
+ * Prints one result row.
+ */
+void report(const string& workload, const string& stage, double seconds, size_t bytes, size_t commands)
+{
+	if (seconds <= 0)
+		seconds = 1e-9;
+	cout << left << setw(10) << workload << setw(16) << stage << right << fixed 
+		<< setw(10) << setprecision(3) << seconds * 1000 << " ms"
+		<< setw(10) << setprecision(1) << bytes / seconds / 1e6 << " MB/s"
+		<< setw(10) << setprecision(1) << commands / seconds / 1e6 << " Minstr/s\n";
+}
+
+/**
+ * Parses a size such as 4096, 512K, 16M or 1G.
+ */
+size_t parseSize(const string& text)
+{
+	size_t size = (size_t)atoll(text.c_str());
+	char unit = text.empty() ? 0 : text[text.size() - 1];
+	if (unit == 'K' || unit == 'k')
+		size <<= 10;
+	else if (unit == 'M' || unit == 'm')
+		size <<= 20;
+	else if (unit == 'G' || unit == 'g')
+		size <<= 30;
+	return size;
+}
+
+/**
+ * Reads a size in kB from /proc/self/status, such as VmRSS or VmHWM, the peak since resetPeakMemory.
+ *
+ * @return The size in bytes, or 0 if it could not be read.
+ */
+size_t memoryStatus(const string& field)
+{
+	size_t value = 0;
+	FILE* file = fopen("/proc/self/status", "r");
+	if (file == NULL)
+		return 0;
+	char line[256];
+	while (fgets(line, sizeof(line), file) != NULL)
+	{
+		if (string(line).compare(0, field.size() + 1, field + ":") == 0)
+			value = strtoull(line + field.size() + 1, NULL, 10) * 1024;
+	}
+	fclose(file);
+	return value;
+}
+
+/**
+ * Resets the peak resident memory of the process to what it is now.
+ *
+ * @return true if it could, which needs Linux.
+ */
+bool resetPeakMemory()
+{
+	FILE* file = fopen("/proc/self/clear_refs", "w");
+	if (file == NULL)
+		return false;
+	bool done = (fputs("5", file) >= 0);
+	return (fclose(file) == 0) && done;
+}
+
+/**
+ * Assembles the workload from a file in lean mode and the usual way, printing the peak memory each adds.
+ * Lean mode must give the same output within the size of the source, 2 bytes per instruction and the 
+ * symbol table, with room for its blocks and the program: a sixteenth of the source and about 3 MB.
+ *
+ * @return 0, or 1 if lean mode went over or gave other output.
+ */
+int benchMemory(const string& workload, const string& source, size_t commands, int symbols)
+{
+	string asmPath = "hackBench.tmp.asm";
+	string hackPath = "hackBench.tmp.hack";
+	if (Formatter::writeFile(asmPath, source.data(), source.size()) == 1 || !resetPeakMemory())
+	{
+		remove(asmPath.c_str());
+		return 0; // Not measurable here.
+	}
+	size_t peaks[2];
+	string outputs[2];
+	for (int usual = 0; usual < 2; usual++)
+	{
+		Assembler assembler;
+		assembler.setLean(usual == 0);
+		resetPeakMemory();
+		size_t before = memoryStatus("VmRSS");
+		assembler.assemble(&asmPath[0]);
+		peaks[usual] = memoryStatus("VmHWM") - before;
+		Source output;
+		if (output.open(hackPath.c_str()) == 0)
+			outputs[usual].assign(output.getData(), output.getSize());
+	}
+	remove(asmPath.c_str());
+	remove(hackPath.c_str());
+	
+	// The slack is for a block of formatted words, a scanned block and the program itself, and grows only slowly
+	// with the source, so holding the whole program as the usual way does goes over at any size but the smallest.
+	size_t slack = source.size() / 16 + Formatter::hackSize(Assembler::LEAN_FORMAT_WORDS) + ((size_t)2 << 20);
+	size_t budget = source.size() + 2 * commands + 64 * (size_t)symbols + slack;
+	cout << left << setw(10) << workload << setw(16) << "peak memory" << right << fixed << setprecision(1)
+		<< setw(10) << peaks[0] / 1e6 << " MB lean," << setw(8) << peaks[1] / 1e6 << " MB usual, budget " 
+		<< budget / 1e6 << " MB";
+	if (peaks[0] > budget || outputs[0] != outputs[1] || outputs[0].empty() != (commands == 0))
+	{
+		cout << ": FAILED\n";
+		return 1;
+	}
+	cout << "\n";
+	return 0;
+}
+
+/**
+ * Benchmarks every stage on one workload.
+ *
+ * @return 0 on success, 1 if the generated program did not assemble.
+ */
+int bench(const string& workload, size_t size, int repeats)
+{
+	ProgramGenerator generator(42);
+	string source = generator.generate(workload, size);
+	const char* data = source.data();
+	size_t bytes = source.size();
+	
+	// Make sure the program assembles before timing anything.
+	AssemblyContext context;
+	AssemblyResult result;
+	if (!context.assemble(string_view(source), &result))
+	{
+		cout << workload << ": " << result.diagnostics[0].message << "\n";
+		return 1;
+	}
+	size_t commands = result.words.size();
+	
+	// Every mode must find the same commands, labels and lines as MODE_SCALAR, also with CRLF line ends and tabs.
+	string crlf;
+	for (size_t i = 0; i < bytes; i++)
+	{
+		if (data[i] == '\n')
+			crlf += "\t\r\n";
+		else
+			crlf += (data[i] == ' ') ? '\t' : data[i];
+	}
+	int savedMode = Scanner::getMode();
+	vector<Instruction> expected[2];
+	vector<Label> expectedLabels[2];
+	int expectedLines[2] = {0, 0};
+	for (int mode = Scanner::MODE_SCALAR; mode <= Scanner::bestMode(); mode++)
+	{
+		static const char* const NAMES[] = {"scan scalar", "scan sse2", "scan avx2"};
+		Scanner::setMode(mode);
+		vector<Instruction> instructions;
+		vector<Label> labels;
+		int lines = 0;
+		double seconds = timeBest(repeats, [&]()
+		{
+			instructions.clear();
+			labels.clear();
+			lines = Scanner::scan(data, 0, bytes, &instructions, &labels);
+		});
+		report(workload, NAMES[mode], seconds, bytes, commands);
+		
+		for (int variant = 0; variant < 2; variant++)
+		{
+			if (variant == 1)
+			{
+				instructions.clear();
+				labels.clear();
+				lines = Scanner::scan(crlf.data(), 0, crlf.size(), &instructions, &labels);
+			}
+			if (mode == Scanner::MODE_SCALAR)
+			{
+				expected[variant] = instructions;
+				expectedLabels[variant] = labels;
+				expectedLines[variant] = lines;
+				continue;
+			}
+			bool same = (lines == expectedLines[variant] && instructions.size() == expected[variant].size()
+				&& labels.size() == expectedLabels[variant].size());
+			for (size_t i = 0; same && i < instructions.size(); i++)
+			{
+				const Instruction& x = instructions[i];
+				const Instruction& y = expected[variant][i];
+				same = (x.start == y.start && x.length == y.length && x.kind == y.kind && x.line == y.line);
+			}
+			for (size_t i = 0; same && i < labels.size(); i++)
+			{
+				const Label& x = labels[i];
+				const Label& y = expectedLabels[variant][i];
+				same = (x.start == y.start && x.length == y.length && x.address == y.address);
+			}
+			if (!same)
+			{
+				Scanner::setMode(savedMode);
+				cout << left << setw(10) << workload << setw(16) << NAMES[mode] << "FAILED: not the same as scan scalar"
+					<< (variant == 1 ? " with CRLF and tabs\n" : "\n");
+				return 1;
+			}
+		}
+	}
+	Scanner::setMode(savedMode);
+	
+	Resolver resolver;
+	report(workload, "tokenize", timeBest(repeats, [&]()
+	{
+		resolver.initializeVars();
+		resolver.tokenize(data, bytes);
+	}), bytes, commands);
+	report(workload, "resolve", timeBest(repeats, [&]()
+	{
+		resolver.resolve(data, bytes); // tokenize and resolveSymbols; variables are only added on a fresh table.
+	}), bytes, commands);
+	
+	Interpreter interpreter;
+	report(workload, "interpret", timeBest(repeats, [&]()
+	{
+		interpreter.interpret(&resolver.getProgram());
+	}), bytes, commands);
+	
+	// With warm buffers, resolving and interpreting must not allocate per line; only the symbol table
+	// may grow. Its copy of the built-in symbols and each doubling of its name pool, symbols and slots
+	// allocate, so about 3 log2 of the symbol count in all.
+	// Only builds with HACK_COUNT_ALLOCATIONS count them.
+	if (AllocationCounter::isCounting())
+	{
+		AllocationCounter::start();
+		resolver.resolve(data, bytes);
+		interpreter.interpret(&resolver.getProgram());
+		AllocationCounter::stop();
+		long long allocations = AllocationCounter::getCount();
+		size_t lines = resolver.getNewLineCount() + 1;
+		long long grows = 1;
+		for (int size = resolver.getSymbols().size(); size > 1; size /= 2)
+			grows++;
+		long long allowed = 3 * grows + 8;
+		cout << left << setw(10) << workload << setw(16) << "allocations" << right << setw(10) << allocations 
+			<< " for " << lines << " lines, at most " << allowed << (allocations > allowed ? ": FAILED\n" : "\n");
+		if (allocations > allowed)
+			return 1;
+	}
+	else
+		cout << left << setw(10) << workload << setw(16) << "allocations" << "not counted: built without HACK_COUNT_ALLOCATIONS\n";
+
+	// The source map: every label and variable must be found by name and at its value, every address
+	// must keep its line, and the map must read back the same in place.
+	const SymbolTable& symbols = resolver.getSymbols();
+	int firstLabel = SymbolTable::predefined().size();
+	SourceMap sourceMap;
+	report(workload, "source map", timeBest(repeats, [&]()
+	{
+		sourceMap.build(resolver.getProgram(), symbols, resolver.getLabelCount());
+	}), bytes, commands);
+	SourceMap mapped;
+	bool mapOk = (mapped.read(sourceMap.getData(), sourceMap.getSize(), true) == 0 && mapped.getWordCount() == commands);
+	for (int id = firstLabel; mapOk && id < symbols.size(); id++)
+	{
+		string_view name = symbols.getName(id);
+		bool isLabel = (id < firstLabel + resolver.getLabelCount());
+		int value = isLabel ? mapped.findLabel(name.data(), (int)name.size()) : mapped.findVariable(name.data(), (int)name.size());
+		string_view at = isLabel ? mapped.labelAt(value) : mapped.variableAt(value);
+		mapOk = (value == symbols.getValue(id) && !at.empty());
+	}
+	for (size_t i = 0; mapOk && i < commands; i++)
+		mapOk = (mapped.getLine((int)i) == resolver.getProgram().lines[i]);
+	if (!mapOk)
+	{
+		cout << left << setw(10) << workload << setw(16) << "source map" << "FAILED: lookups do not match the symbols\n";
+		return 1;
+	}
+
+	string text(Formatter::hackSize(commands), '\0');
+	report(workload, "format", timeBest(repeats, [&]()
+	{
+		Formatter::writeHack(result.words.data(), commands, &text[0]);
+	}), text.size(), commands);
+	
+	string path = "hackBench.tmp.hack";
+	report(workload, "write", timeBest(repeats, [&]()
+	{
+		Formatter::writeFile(path, text.data(), text.size());
+	}), text.size(), commands);
+	remove(path.c_str());
+	
+	report(workload, "end to end", timeBest(repeats, [&]()
+	{
+		context.assemble(string_view(source), &result);
+		Formatter::writeHack(result.words.data(), result.words.size(), &text[0]);
+	}), bytes, commands);
+	
+	if (benchMemory(workload, source, commands, result.symbols.size()) == 1)
+		return 1;
+	
+	// Edits in the middle: one that keeps every address, and one that moves every later command.
+	IncrementalAssembler incremental;
+	incremental.load(string_view(source));
+	int middle = incremental.getLineCount() / 2;
+	report(workload, "edit in place", timeBest(repeats, [&]()
+	{
+		incremental.edit(middle, 1, "D=D+1\n");
+	}), bytes, commands);
+	bool inserted = false;
+	report(workload, "edit, shift", timeBest(repeats, [&]()
+	{
+		if (inserted)
+			incremental.edit(middle, 1, "");
+		else
+			incremental.edit(middle, 0, "D=D+1\n");
+		inserted = !inserted;
+	}), bytes, commands);
+
+	// The program as 8 modules assembled ahead of time; linking them must give the same words.
+	vector<ObjectModule> modules(8);
+	size_t begin = 0;
+	for (size_t i = 0; i < modules.size(); i++)
+	{
+		size_t end = (i == modules.size() - 1) ? string::npos : source.find('\n', bytes / modules.size() * (i + 1));
+		end = (end == string::npos) ? bytes : end + 1;
+		modules[i].assemble(data + begin, end - begin);
+		begin = end;
+	}
+	Linker linker;
+	vector<uint16_t> linked;
+	report(workload, "link", timeBest(repeats, [&]()
+	{
+		linker.link(modules, &linked);
+	}), bytes, commands);
+	context.assemble(string_view(source), &result);
+	if (linked != result.words)
+	{
+		cout << left << setw(10) << workload << setw(16) << "link" << "FAILED: not the same as assembling the whole\n";
+		return 1;
+	}
+
+	ObjectModule whole;
+	whole.assemble(data, bytes);
+	Optimizer optimizer;
+	vector<uint16_t> optimized;
+	report(workload, "optimize", timeBest(repeats, [&]()
+	{
+		optimizer.optimize(whole, &optimized);
+	}), bytes, commands);
+	cout << left << setw(10) << workload << setw(16) << "removed" << right
+		<< setw(10) << optimizer.getRemovedCount() << " of " << commands << " instructions\n";
+
+	// Reading the hack code back and disassembling it; assembling the asm code again must give the same words,
+	// with the labels given back or not.
+	vector<uint16_t> read;
+	report(workload, "read hack", timeBest(repeats, [&]()
+	{
+		Formatter::readHack(text.data(), text.size(), &read);
+	}), text.size(), commands);
+	Disassembler disassembler;
+	string disassembled;
+	for (int named = 0; named < 2; named++)
+	{
+		disassembler.setLabels(named ? whole.getSymbols() : SymbolTable());
+		string stage = named ? "disasm, labels" : "disassemble";
+		report(workload, stage, timeBest(repeats, [&]()
+		{
+			disassembler.disassemble(read.data(), read.size(), &disassembled);
+		}), text.size(), commands);
+		context.assemble(string_view(disassembled), &result);
+		if (read != linked || result.words != linked)
+		{
+			cout << left << setw(10) << workload << setw(16) << stage << "FAILED: does not assemble back the same\n";
+			return 1;
+		}
+	}
+	if (WorkPool::defaultThreadCount() > 1)
+	{
+		disassembler.setThreads(0);
+		report(workload, "disasm, par", timeBest(repeats, [&]()
+		{
+			disassembler.disassemble(read.data(), read.size(), &disassembled);
+		}), text.size(), commands);
+	}
+
+	if (WorkPool::defaultThreadCount() > 1 && bytes >= 2 * ParallelAssembler::MIN_CHUNK_SIZE)
+	{
+		context.setThreads(0);
+		report(workload, "parallel", timeBest(repeats, [&]()
+		{
+			context.assemble(string_view(source), &result);
+		}), bytes, commands);
+		context.setThreads(1);
+	}
+	return 0;
+}
+
+/**
+ * Times Executor on a loop that never ends, for a fixed number of cycles, with and without profiling.
+ * Both runs must leave the same memory, and the profile must count every cycle.
+ *
+ * @return 0, or 1 if a check failed.
+ */
+int benchExecute(int repeats)
+{
+	const unsigned long long CYCLES = 50000000;
+	string source = "(LOOP)\n@i\nM=M+1\nD=M\n@sum\nM=D+M\n@LOOP\n0;JMP\n";
+	AssemblyContext context;
+	AssemblyResult result;
+	context.assemble(string_view(source), &result);
+	Executor executor;
+	executor.load(result.words.data(), result.words.size());
+	int16_t sums[2];
+	for (int profile = 0; profile < 2; profile++)
+	{
+		executor.setProfiling(profile == 1);
+		int stop = Executor::STOP_BUDGET;
+		double seconds = timeBest(repeats, [&]()
+		{
+			executor.reset();
+			stop = executor.run(CYCLES);
+		});
+		sums[profile] = executor.peek(Resolver::VAR_ASSIGN_ADD_START + 1);
+		unsigned long long counted = 0;
+		for (size_t i = 0; i < executor.getCounts().size(); i++)
+			counted += executor.getCounts()[i];
+		string stage = profile ? "execute, prof" : "execute";
+		if (stop != Executor::STOP_BUDGET || executor.getCycles() != CYCLES || (profile && counted != CYCLES) || sums[profile] != sums[0])
+		{
+			cout << left << setw(10) << "loop" << setw(16) << stage << "FAILED\n";
+			return 1;
+		}
+		if (seconds <= 0)
+			seconds = 1e-9;
+		cout << left << setw(10) << "loop" << setw(16) << stage << right << fixed
+			<< setw(10) << setprecision(3) << seconds * 1000 << " ms"
+			<< setw(10) << setprecision(1) << CYCLES / seconds / 1e6 << " Mcycles/s\n";
+	}
+	return 0;
+}
+
+/**
+ * Times StreamAssembler on a long stream of forward jumps, each label declared a few jumps after its first use.
+ * Only those few fixups wait at once, so the fixups kept and the words held must not grow with the stream.
+ *
+ * @return 0, or 1 if a check failed.
+ */
+int benchStream(size_t size, int repeats)
+{
+	const int AHEAD = 16; // Jumps between a label's use and its declaration.
+	string source;
+	int jumps = 0;
+	for (; source.size() < size; jumps++)
+	{
+		source += "@F" + to_string(jumps) + "\n0;JMP\n";
+		if (jumps >= AHEAD)
+			source += "(F" + to_string(jumps - AHEAD) + ")\n";
+	}
+	for (int i = max(jumps - AHEAD, 0); i < jumps; i++)
+		source += "(F" + to_string(i) + ")\n";
+	size_t commands = 2 * (size_t)jumps;
+
+	FILE* input = tmpfile();
+	FILE* output = tmpfile();
+	if (input == NULL || output == NULL || fwrite(source.data(), 1, source.size(), input) != source.size() || fflush(input) != 0)
+	{
+		cout << left << setw(10) << "stream" << setw(16) << "stream" << "FAILED: no temporary files\n";
+		return 1;
+	}
+	StreamAssembler stream;
+	int failed = 0;
+	double seconds = timeBest(repeats, [&]()
+	{
+		rewind(input);
+		rewind(output);
+		failed |= stream.assemble(fileno(input), output);
+	});
+	fclose(input);
+	fclose(output);
+	if (failed || stream.getWordCount() != commands)
+	{
+		cout << left << setw(10) << "stream" << setw(16) << "stream" << "FAILED: " << stream.getError() << "\n";
+		return 1;
+	}
+	report("stream", "stream", seconds, source.size(), commands);
+	size_t maxFixups = stream.getMaxFixups();
+	size_t maxHeld = stream.getMaxHeldWords();
+	size_t allowedHeld = StreamAssembler::READ_SIZE / 2 + StreamAssembler::FLUSH_WORDS; // A block of 2 byte commands.
+	bool bounded = maxFixups <= (size_t)AHEAD + 1 && maxHeld <= allowedHeld;
+	cout << left << setw(10) << "stream" << setw(16) << "fixups" << right << setw(10) << maxFixups
+		<< " at most, " << maxHeld << " words held, for " << commands << " commands" << (bounded ? "\n" : ": FAILED\n");
+	return bounded ? 0 : 1;
+}
+
+/**
+ * Runs a program of loops whose jumps only go to labels, as assembled and with -O, to its halt loop.
+ * Leaving out instructions that do nothing must not change what the program does: both runs must halt,
+ * with the same RAM, and -O must have taken cycles off.
+ *
+ * @return 0, or 1 if a check failed.
+ */
+int benchOptimizedRun()
+{
+	const unsigned long long CYCLES = 100000000;
+	ProgramGenerator generator(7);
+	string source = generator.loops(500); // About 18K words, so every label fits in the 32K ROM.
+	AssemblyContext context;
+	AssemblyResult result;
+	ObjectModule module;
+	if (!context.assemble(string_view(source), &result) || module.assemble(source.data(), source.size()) == 1)
+	{
+		cout << left << setw(10) << "loops" << setw(16) << "-O, same run" << "FAILED: could not assemble\n";
+		return 1;
+	}
+	Optimizer optimizer;
+	vector<uint16_t> optimized;
+	optimizer.optimize(module, &optimized);
+
+	Executor plain;
+	Executor fast;
+	plain.load(result.words.data(), result.words.size());
+	fast.load(optimized.data(), optimized.size());
+	int plainStop = plain.run(CYCLES);
+	int fastStop = fast.run(CYCLES);
+	int differ = -1; // The first register that differs.
+	for (int address = 0; address < Executor::RAM_SIZE && differ == -1; address++)
+	{
+		if (plain.peek(address) != fast.peek(address))
+			differ = address;
+	}
+	cout << left << setw(10) << "loops" << setw(16) << "-O, same run" << right << setw(10) << fast.getCycles()
+		<< " of " << plain.getCycles() << " cycles, " << optimizer.getRemovedCount() << " of " << result.words.size() << " instructions removed";
+	if (plainStop != Executor::STOP_HALT || fastStop != Executor::STOP_HALT)
+	{
+		cout << ": FAILED, did not halt\n";
+		return 1;
+	}
+	if (differ != -1)
+	{
+		cout << ": FAILED, RAM[" << differ << "] is " << fast.peek(differ) << ", not " << plain.peek(differ) << "\n";
+		return 1;
+	}
+	if (optimizer.getRemovedCount() == 0 || fast.getCycles() >= plain.getCycles())
+	{
+		cout << ": FAILED, nothing left out\n";
+		return 1;
+	}
+	cout << "\n";
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t size = (argc > 1) ? parseSize(argv[1]) : (size_t)16 << 20;
+	string only = (argc > 2) ? argv[2] : "all";
+	int repeats = (argc > 3) ? atoi(argv[3]) : 3;
+	if (size == 0 || repeats < 1)
+	{
+		cout << "Usage: hackBench [size, e.g. 512K, 16M or 1G] [workload] [repeats]\n";
+		return 1;
+	}
+	
+	static const char* const WORKLOADS[] = {"comments", "labels", "variables", "ccode", "mixed"};
+	int error = 0;
+	bool found = false;
+	for (int i = 0; i < 5; i++)
+	{
+		if (only == "all" || only == WORKLOADS[i])
+		{
+			found = true;
+			error |= bench(WORKLOADS[i], size, repeats);
+		}
+	}
+	if (only == "all" || only == "stream")
+	{
+		found = true;
+		error |= benchStream(size, repeats);
+	}
+	if (only == "all" || only == "execute")
+	{
+		found = true;
+		error |= benchExecute(repeats);
+		error |= benchOptimizedRun();
+	}
+	if (!found)
+	{
+		cout << "Unknown workload " << only << "; use comments, labels, variables, ccode, mixed, stream, execute or all\n";
+		return 1;
+	}
+	return error;
+}
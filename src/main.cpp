@@ -1,51 +1,546 @@
-/************************************************************************-
- *	HACKAssembler, the assembler that converts .asm files to .hack files by translating 
- *  hack asm language to binary strings. 
- *  Hack is a machine language code for the simulated HACK computer, from the class "From Nand2Tetris".
- *  
- *	HACK Code specification:
- *
- *		Two types of commands, A and C.
- *		A starts with @ in asm; 0 in hack. Used for addressing registers:
- *		"@R5"
- *		"0000000000000001"
- *		The rest of the bits are a 15 bit address.
- *
- *		C starts with anything else in asm; 1 in hack. used for computations and jumps:
- *		"D=M"
- *		"1110000010010000"
- *		The 2nd two bits are not used and are set to 1.
- *		The next 7 are computation bits.
- *		The next 3 are destination bits - what register(s) are going to receive input.
- *		The last 3 are jump bits, determining if the program should jump to the current address value set by a, 
- *      Depending on the previous calculation in the command.
- *			The comparisons are relative to zero (JLT = Jump less than zero, etc). JMP is unconditional. 
- *
- *	Started: December 15, 2017
- *  Finished: December 22, 2017
- *  Updates:
- *		- 
- *	©2018 C. A. Acred all rights reserved.
- ----------------------------------------------------------*
-*/
-
-// Compile: g++ main.cpp hackASM/hackASM.cpp -o hackAssembler -std=c++11 -static-libgcc -static-libstdc++
-// Debug:   g++ -g main.cpp hackASM/hackASM.cpp -o hackAssembler -std=c++11 -static-libgcc -static-libstdc++
-
-#include "hackASM/hackASM.h"
-#include <iostream>
-
-main(int argc, char** argv)
-{
-	if (argc != 2) // Make sure you got a path, and only one path.
-	{
-		cout << "Invalid usage; Usage: hackAssembler (path to .asm file)\n";
-		return 1;
-	}
-	
-	Assembler* assembler = new Assembler();
-	int error = assembler->assemble(argv[1]);
-	if (error == 1)
-		return 1;
-    return 0;
+/************************************************************************-
+ *	HACKAssembler, the assembler that converts .asm files to .hack files by translating 
+ *  hack asm language to binary strings. 
+ *  Hack is a machine language code for the simulated HACK computer, from the class "From Nand2Tetris".
+ *  
+ *	HACK Code specification:
+ *
+ *		Two types of commands, A and C.
+ *		A starts with @ in asm; 0 in hack. Used for addressing registers:
+ *		"@R5"
+ *		"0000000000000001"
+ *		The rest of the bits are a 15 bit address.
+ *
+ *		C starts with anything else in asm; 1 in hack. used for computations and jumps:
+ *		"D=M"
+ *		"1110000010010000"
+ *		The 2nd two bits are not used and are set to 1.
+ *		The next 7 are computation bits.
+ *		The next 3 are destination bits - what register(s) are going to receive input.
+ *		The last 3 are jump bits, determining if the program should jump to the current address value set by a, 
+ *      Depending on the previous calculation in the command.
+ *			The comparisons are relative to zero (JLT = Jump less than zero, etc). JMP is unconditional. 
+ *
+ *	Started: December 15, 2017
+ *  Finished: December 22, 2017
+ *  Updates:
+ *		- 
+ *	©2018 C. A. Acred all rights reserved.
+ ----------------------------------------------------------*
+*/
+
+// Compile: g++ main.cpp hackASM/hackASM.cpp hackASM/hackSource.cpp hackASM/hackBatch.cpp hackASM/hackParallel.cpp hackASM/hackScan.cpp hackASM/hackStats.cpp hackASM/hackCache.cpp hackASM/hackServer.cpp hackASM/hackStream.cpp hackASM/hackIncremental.cpp hackASM/hackObject.cpp hackASM/hackOptimize.cpp hackASM/hackExecute.cpp hackASM/hackDisassemble.cpp hackASM/hackSourceMap.cpp -o hackAssembler -std=c++17 -pthread -static-libgcc -static-libstdc++
+// Debug:   g++ -g -DHACK_COUNT_ALLOCATIONS main.cpp hackASM/hackASM.cpp hackASM/hackSource.cpp hackASM/hackBatch.cpp hackASM/hackParallel.cpp hackASM/hackScan.cpp hackASM/hackStats.cpp hackASM/hackCache.cpp hackASM/hackServer.cpp hackASM/hackStream.cpp hackASM/hackIncremental.cpp hackASM/hackObject.cpp hackASM/hackOptimize.cpp hackASM/hackExecute.cpp hackASM/hackDisassemble.cpp hackASM/hackSourceMap.cpp -o hackAssembler -std=c++17 -pthread -static-libgcc -static-libstdc++
+
+#include "hackASM/hackASM.h"
+#include <iostream>
+#include <algorithm>
+#include <sys/stat.h>
+
+const char* USAGE = 
+	"Usage: hackAssembler [options] (path to .asm file)\n"
+	"       hackAssembler [options] [-j threads] (.asm files, directories or @list files)...\n"
+	"  --stream          Read asm code from stdin and write .hack text to stdout as it is assembled.\n"
+	"  --rom             Write a binary ROM image (.rom) instead of .hack text.\n"
+	"  -O                Leave out instructions that do nothing, to save cycles; jumps must only go to labels.\n"
+	"  --object          Assemble each file on its own into an object module (.hobj), for --link.\n"
+	"  --link=output     Link the .hobj and .asm files, in order, into one program at output.\n"
+	"  --lean            Keep the peak memory near the size of the source, for very large files; not cached.\n"
+	"  --map             Also write a .hmap source map of every address, label and variable, for tools; not cached.\n"
+	"  --listing         Also write a .lst listing of every address, word and source line; not cached.\n"
+	"  --disassemble     Turn .hack and .rom files back into asm code, at (name).dis.asm.\n"
+	"  --labels=file     Give labels back when disassembling, from the .asm or .hobj file of the program.\n"
+	"  --run[=cycles]    Run the program on a built-in HACK CPU (default 100M cycles) and profile it into a .prof file.\n"
+	"  --stats           Print the time of each stage, counts and memory use of every file as JSON\n"
+	"                    (allocations only in builds with -DHACK_COUNT_ALLOCATIONS).\n"
+	"  --cache[=dir]     Skip files assembled before, keeping their output in dir\n"
+	"                    (default HACK_CACHE_DIR, or the user's cache directory).\n"
+	"  --cache-size=N    Most bytes the cache keeps, with an optional K, M or G (default 256M).\n"
+	"  --serve[=socket]  Stay running, assembling for clients over a Unix domain socket\n"
+	"                    (default HACK_SOCKET, or one in /tmp for the user).\n"
+	"  --connect[=socket] Have the server assemble the files instead, as .hack text; - sends stdin and prints the hack code.\n"
+	"  --shutdown[=socket] Stop the server.\n";
+
+/**
+ * @param text A number with an optional K, M or G unit.
+ * @return The number in bytes.
+ */
+unsigned long long parseSize(const string& text)
+{
+	unsigned long long size = strtoull(text.c_str(), NULL, 10);
+	char unit = text.empty() ? 0 : text[text.size() - 1];
+	if (unit == 'K' || unit == 'k')
+		size <<= 10;
+	else if (unit == 'M' || unit == 'm')
+		size <<= 20;
+	else if (unit == 'G' || unit == 'g')
+		size <<= 30;
+	return size;
+}
+
+/**
+ * Sends the files named by args, or stdin for "-", to a server, or stops it.
+ *
+ * @param mode "--connect" or "--shutdown".
+ * @param socketPath The server's socket.
+ * @param args The files, directories or @list files.
+ * @return 0 on success, 1 if any file failed.
+ */
+int runClient(const string& mode, const string& socketPath, const vector<string>& args)
+{
+	AssemblyClient client;
+	if (client.connect(socketPath) == 1)
+	{
+		cout << client.getError() << "\n";
+		return 1;
+	}
+	if (mode == "--shutdown")
+		return client.shutdown();
+	
+	if (args.size() == 1 && args[0] == "-")
+	{
+		Source input;
+		string output;
+		if (input.open("-") == 1 || client.assembleSource(string_view(input.getData(), input.getSize()), &output) == 1)
+		{
+			cout << client.getError() << "\n";
+			return 1;
+		}
+		return Formatter::writeFile("-", output.data(), output.size());
+	}
+	
+	Batch batch;
+	int error = 0;
+	for (size_t i = 0; i < args.size(); i++)
+		error |= batch.add(args[i]);
+	if (batch.getFileCount() == 0)
+	{
+		cout << "No .asm files found; " << USAGE;
+		return 1;
+	}
+	vector<string> errors;
+	if (client.assemble(batch.getPaths(), &errors) == 1)
+	{
+		cout << client.getError() << "\n";
+		return 1;
+	}
+	for (size_t i = 0; i < errors.size(); i++)
+	{
+		if (!errors[i].empty())
+		{
+			cout << batch.getPaths()[i] << ": " << errors[i] << "\n";
+			error = 1;
+		}
+	}
+	return error;
+}
+
+/**
+ * Links the object modules and asm files named by paths, in order, into one program,
+ * the same as assembling their sources one after the other.
+ *
+ * @param outputPath Where the program goes, or "-" for stdout.
+ * @param paths The .hobj and .asm files.
+ * @param format Formatter::FORMAT_HACK or FORMAT_ROM.
+ * @return 0 on success, 1 if a file could not be read or assembled, or the output written.
+ */
+int runLink(const string& outputPath, const vector<string>& paths, int format)
+{
+	if (paths.empty())
+	{
+		cout << "No files to link; " << USAGE;
+		return 1;
+	}
+	vector<ObjectModule> modules(paths.size());
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		Source input;
+		if (input.open(paths[i].c_str()) == 1)
+		{
+			cout << paths[i] << ": Could not read the file\n";
+			return 1;
+		}
+		bool isObject = paths[i].size() > 5 && paths[i].compare(paths[i].size() - 5, 5, ".hobj") == 0;
+		int failed = isObject ? modules[i].read(input.getData(), input.getSize()) : modules[i].assemble(input.getData(), input.getSize());
+		if (failed == 1)
+		{
+			cout << paths[i] << ": ";
+			if (modules[i].getErrorLine() > 0)
+				cout << "Line " << modules[i].getErrorLine() << ": ";
+			cout << modules[i].getError() << "\n";
+			return 1;
+		}
+	}
+	
+	Linker linker;
+	vector<uint16_t> words;
+	linker.link(modules, &words);
+	string output = Formatter::format(words, format);
+	if (Formatter::writeFile(outputPath, output.data(), output.size()) == 1)
+	{
+		cout << "Could not write " << outputPath << "\n";
+		return 1;
+	}
+	return 0;
+}
+
+/**
+ * Disassembles the .hack and .rom files named by paths, each to a .dis.asm file next to it.
+ *
+ * @param paths The files, or "-" for .hack text on stdin, disassembled to stdout.
+ * @param labelsPath The .asm or .hobj file to take labels from, or an empty string for none.
+ * @param threads The number of threads for each file, or 0 for one per hardware thread.
+ * @return 0 on success, 1 if any file could not be read, disassembled or written.
+ */
+int runDisassemble(const vector<string>& paths, const string& labelsPath, int threads)
+{
+	if (paths.empty())
+	{
+		cout << "No files to disassemble; " << USAGE;
+		return 1;
+	}
+	Disassembler disassembler;
+	disassembler.setThreads(threads);
+	if (!labelsPath.empty())
+	{
+		Source input;
+		ObjectModule module;
+		bool isObject = labelsPath.size() > 5 && labelsPath.compare(labelsPath.size() - 5, 5, ".hobj") == 0;
+		if (input.open(labelsPath.c_str()) == 1 
+			|| (isObject ? module.read(input.getData(), input.getSize()) : module.assemble(input.getData(), input.getSize())) == 1)
+		{
+			cout << labelsPath << ": Could not read the labels\n";
+			return 1;
+		}
+		disassembler.setLabels(module.getSymbols());
+	}
+	
+	int error = 0;
+	vector<uint16_t> words;
+	string output;
+	for (size_t i = 0; i < paths.size(); i++)
+	{
+		Source input;
+		if (input.open(paths[i].c_str()) == 1)
+		{
+			cout << paths[i] << ": Could not read the file\n";
+			error = 1;
+			continue;
+		}
+		bool isROM = paths[i].size() > 4 && paths[i].compare(paths[i].size() - 4, 4, ".rom") == 0;
+		int failed = isROM ? Formatter::readROM(input.getData(), input.getSize(), &words) : Formatter::readHack(input.getData(), input.getSize(), &words);
+		input.close();
+		if (failed == 1)
+		{
+			cout << paths[i] << ": Not a valid " << (isROM ? "ROM image" : ".hack file") << "\n";
+			error = 1;
+			continue;
+		}
+		if (disassembler.disassemble(words.data(), words.size(), &output) == 1)
+		{
+			cout << paths[i] << ": " << disassembler.getError() << "\n";
+			error = 1;
+			continue;
+		}
+		string outputPath = (paths[i] == "-") ? paths[i] : paths[i].substr(0, paths[i].find_last_of(".")) + ".dis.asm";
+		if (Formatter::writeFile(outputPath, output.data(), output.size()) == 1)
+		{
+			cout << "Could not write " << outputPath << "\n";
+			error = 1;
+		}
+	}
+	return error;
+}
+
+/**
+ * Assembles the file at path and runs it on the built-in executor, then prints the cycles it took,
+ * the runs of each label and the hottest instructions, and writes the runs of every instruction to a .prof file.
+ *
+ * @param path The .asm file.
+ * @param budget The most cycles to run for.
+ * @param optimize true to run the program as -O writes it.
+ * @return 0 on success, 1 if the file could not be read or assembled, or the profile written.
+ */
+int runProgram(const string& path, unsigned long long budget, bool optimize)
+{
+	Source input;
+	if (input.open(path.c_str()) == 1)
+	{
+		cout << path << ": Could not read the file\n";
+		return 1;
+	}
+	ObjectModule module;
+	if (module.assemble(input.getData(), input.getSize()) == 1)
+	{
+		cout << path << ": Line " << module.getErrorLine() << ": " << module.getError() << "\n";
+		return 1;
+	}
+
+	// origins maps each word run back to its command in the source.
+	vector<uint16_t> words;
+	vector<int> origins;
+	if (optimize)
+	{
+		Optimizer optimizer;
+		optimizer.optimize(module, &words);
+		origins = optimizer.getOrigins();
+	}
+	else
+	{
+		Linker linker;
+		linker.link(vector<ObjectModule>(1, module), &words);
+		for (size_t i = 0; i < words.size(); i++)
+			origins.push_back((int)i);
+	}
+
+	Executor executor;
+	executor.load(words.data(), words.size());
+	executor.setProfiling(true);
+	int stop = executor.run(budget);
+	const vector<unsigned long long>& counts = executor.getCounts();
+
+	vector<Instruction> commands;
+	vector<Label> labels;
+	Resolver::scan(input.getData(), 0, input.getSize(), &commands, &labels);
+	const char* source = input.getData();
+	auto describe = [&](size_t i)
+	{
+		const Instruction& command = commands[origins[i]];
+		return "line " + to_string(command.line) + "  " + string(source + command.start, command.length);
+	};
+
+	cout << executor.getCycles() << " cycles, ";
+	if (stop == Executor::STOP_HALT)
+		cout << "halted at " << executor.getPC() << "\n";
+	else if (stop == Executor::STOP_END)
+		cout << "ran off the end of the program\n";
+	else
+		cout << "stopped after the budget of " << budget << "\n";
+
+	// Labels, by the runs of the instruction each points at.
+	vector<pair<unsigned long long, string>> labelRuns;
+	const SymbolTable& symbols = module.getSymbols();
+	for (int id = 0; id < symbols.size(); id++)
+	{
+		int address = symbols.getValue(id);
+		if (address == SymbolTable::NOT_FOUND)
+			continue;
+		size_t at = lower_bound(origins.begin(), origins.end(), address) - origins.begin();
+		labelRuns.push_back(make_pair(at < counts.size() ? counts[at] : 0, string(symbols.getName(id))));
+	}
+	stable_sort(labelRuns.begin(), labelRuns.end(), [](const pair<unsigned long long, string>& x, const pair<unsigned long long, string>& y) { return x.first > y.first; });
+	if (!labelRuns.empty())
+		cout << "Labels:\n";
+	for (size_t i = 0; i < labelRuns.size(); i++)
+		cout << "  " << labelRuns[i].first << "  (" << labelRuns[i].second << ")\n";
+
+	vector<size_t> hottest(counts.size());
+	for (size_t i = 0; i < hottest.size(); i++)
+		hottest[i] = i;
+	size_t shown = min(hottest.size(), (size_t)10);
+	partial_sort(hottest.begin(), hottest.begin() + shown, hottest.end(), [&](size_t x, size_t y) { return counts[x] > counts[y]; });
+	cout << "Hottest instructions:\n";
+	for (size_t i = 0; i < shown && counts[hottest[i]] > 0; i++)
+		cout << "  " << counts[hottest[i]] << "  @" << hottest[i] << "  " << describe(hottest[i]) << "\n";
+
+	string profile = "address\truns\tline\tcommand\n";
+	for (size_t i = 0; i < counts.size(); i++)
+	{
+		const Instruction& command = commands[origins[i]];
+		profile += to_string(i) + "\t" + to_string(counts[i]) + "\t" + to_string(command.line) + "\t" + string(source + command.start, command.length) + "\n";
+	}
+	string profilePath = path.substr(0, path.find_last_of(".")) + ".prof";
+	if (Formatter::writeFile(profilePath, profile.data(), profile.size()) == 1)
+	{
+		cout << "Could not write " << profilePath << "\n";
+		return 1;
+	}
+	return 0;
+}
+
+main(int argc, char** argv)
+{
+	if (argc < 2) // Make sure you got a path.
+	{
+		cout << "Invalid usage; " << USAGE;
+		return 1;
+	}
+	
+	// Options come first, so one file can be told apart from a batch.
+	vector<string> args;
+	int threads = 0;
+	bool threadsSet = false;
+	bool stats = false;
+	int format = Formatter::FORMAT_HACK;
+	bool optimize = false;
+	bool lean = false;
+	bool sourceMap = false;
+	bool listing = false;
+	bool cacheOn = false;
+	string cacheDirectory = "";
+	unsigned long long cacheSize = AssemblyCache::DEFAULT_MAX_SIZE;
+	string mode = "";
+	string socketPath = AssemblyServer::defaultSocketPath();
+	string linkPath = "";
+	string labelsPath = "";
+	unsigned long long runBudget = 100000000;
+	for (int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if (arg == "--stats")
+			stats = true;
+		else if (arg == "--rom")
+			format = Formatter::FORMAT_ROM;
+		else if (arg == "-O")
+			optimize = true;
+		else if (arg == "--lean")
+			lean = true;
+		else if (arg == "--map")
+			sourceMap = true;
+		else if (arg == "--listing")
+			listing = true;
+		else if (arg == "--object")
+			format = Formatter::FORMAT_OBJECT;
+		else if (arg.compare(0, 7, "--link=") == 0)
+		{
+			mode = "--link";
+			linkPath = arg.substr(7);
+		}
+		else if (arg == "--run" || arg == "--disassemble")
+			mode = arg;
+		else if (arg.compare(0, 9, "--labels=") == 0)
+			labelsPath = arg.substr(9);
+		else if (arg.compare(0, 6, "--run=") == 0)
+		{
+			mode = "--run";
+			runBudget = parseSize(arg.substr(6));
+		}
+		else if (arg == "--cache")
+			cacheOn = true;
+		else if (arg.compare(0, 8, "--cache=") == 0)
+		{
+			cacheOn = true;
+			cacheDirectory = arg.substr(8);
+		}
+		else if (arg.compare(0, 13, "--cache-size=") == 0)
+			cacheSize = parseSize(arg.substr(13));
+		else if (arg == "--serve" || arg == "--connect" || arg == "--shutdown" || arg == "--stream")
+			mode = arg;
+		else if (arg.compare(0, 8, "--serve=") == 0 || arg.compare(0, 10, "--connect=") == 0 || arg.compare(0, 11, "--shutdown=") == 0)
+		{
+			mode = arg.substr(0, arg.find('='));
+			socketPath = arg.substr(arg.find('=') + 1);
+		}
+		else if (arg == "-j" && i + 1 < argc)
+		{
+			threads = atoi(argv[++i]);
+			threadsSet = true;
+		}
+		else if (arg.compare(0, 2, "-j") == 0 && arg.size() > 2)
+		{
+			threads = atoi(arg.c_str() + 2);
+			threadsSet = true;
+		}
+		else
+			args.push_back(arg);
+	}
+	
+	AssemblyCache cache;
+	if (cacheOn && cache.open(cacheDirectory, cacheSize) == 1)
+	{
+		cout << "Could not make cache directory " << cache.getDirectory() << "\n";
+		return 1;
+	}
+	
+	if (mode == "--stream")
+	{
+		StreamAssembler stream;
+		if (stream.assemble(0, stdout) == 1)
+		{
+			cerr << "Line " << stream.getErrorLine() << ": " << stream.getError() << "\n"; // stdout holds the output.
+			return 1;
+		}
+		return 0;
+	}
+	if (mode == "--serve")
+	{
+		AssemblyServer server;
+		server.setThreads(threads);
+		server.setCache(cacheOn ? &cache : NULL);
+		cout << "Serving on " << socketPath << endl;
+		if (server.run(socketPath) == 1)
+		{
+			cout << server.getError() << "\n";
+			return 1;
+		}
+		return 0;
+	}
+	if (mode == "--connect" || mode == "--shutdown")
+	{
+		// The protocol only carries paths and source, so these would be dropped without a word.
+		if (format != Formatter::FORMAT_HACK || optimize || lean || sourceMap || listing || stats || threadsSet)
+		{
+			cout << mode << " cannot take --rom, -O, --object, --map, --listing, --lean, --stats or -j; " << USAGE;
+			return 1;
+		}
+		return runClient(mode, socketPath, args);
+	}
+	if (mode == "--link")
+		return runLink(linkPath, args, (format == Formatter::FORMAT_ROM) ? format : Formatter::FORMAT_HACK);
+	if (mode == "--disassemble")
+		return runDisassemble(args, labelsPath, threads);
+	if (mode == "--run")
+	{
+		if (args.size() != 1)
+		{
+			cout << "--run takes one .asm file; " << USAGE;
+			return 1;
+		}
+		return runProgram(args[0], runBudget, optimize);
+	}
+	
+	struct stat info;
+	if (args.size() == 1 && !threadsSet && args[0][0] != '@' && !(stat(args[0].c_str(), &info) == 0 && S_ISDIR(info.st_mode))) // Only one file.
+	{
+		Assembler* assembler = new Assembler();
+		assembler->setStats(stats);
+		assembler->setCache(cacheOn ? &cache : NULL);
+		assembler->setFormat(format);
+		assembler->setOptimize(optimize);
+		assembler->setLean(lean);
+		assembler->setSourceMap(sourceMap);
+		assembler->setListing(listing);
+		int error = assembler->assemble(&args[0][0]);
+		if (error == 1)
+		{
+			cout << assembler->getError() << "\n";
+			return 1;
+		}
+		if (optimize && assembler->getRemovedCount() > 0 && args[0] != "-") // Not into the hack code on stdout.
+			cout << "Removed " << assembler->getRemovedCount() << " of " << (assembler->getWordCount() + assembler->getRemovedCount()) 
+				<< " instructions, one cycle each every time they would have run\n";
+		if (stats)
+			(args[0] == "-" ? cerr : cout) << assembler->getStats().toJSON(args[0]) << "\n"; // stdout holds the hack code.
+		return 0;
+	}
+	
+	// Batch mode: many files, directories or @list files.
+	Batch batch;
+	batch.setCache(cacheOn ? &cache : NULL);
+	batch.setFormat(format);
+	batch.setOptimize(optimize);
+	batch.setLean(lean);
+	batch.setSourceMap(sourceMap);
+	batch.setListing(listing);
+	int error = 0;
+	for (size_t i = 0; i < args.size(); i++)
+		error |= batch.add(args[i]);
+	if (batch.getFileCount() == 0)
+	{
+		cout << "No .asm files found; " << USAGE;
+		return 1;
+	}
+	if (batch.run(threads, stats) == 1 || error == 1)
+		return 1;
+    return 0;
 }
\ No newline at end of file